@@ -6,8 +6,12 @@
 #include <cstdlib>
 #include <curl/curl.h>
 #include <stdexcept>
-#include "rapidjson/error/error.h"
-#include "rapidjson/reader.h"
+#include "rapidjson/error/en.h"
+#include "neighbor_stream.h"
+#include "connection_pool.h"
+#include "concurrency_controller.h"
+#include "neighbor_fetch.h"
+#include "crawl_journal.h"
 
 struct ParseException : std::runtime_error, rapidjson::ParseResult {
     ParseException(rapidjson::ParseErrorCode code, const char* msg, size_t offset) : 
@@ -15,95 +19,71 @@ struct ParseException : std::runtime_error, rapidjson::ParseResult {
         rapidjson::ParseResult(code, offset) {}
 };
 
-#define RAPIDJSON_PARSE_ERROR_NORETURN(code, offset) \
-    throw ParseException(code, #code, offset)
-
-#include <rapidjson/document.h>
+#include "visited_names.h"
+#include "node_writer.h"
+#include "crawl_telemetry.h"
 #include <chrono>
+#include <functional>
 
 // add the threading and synchronization headers
 #include <thread>
 #include <mutex>
+#include <atomic>
+#include <algorithm>
 #include <condition_variable>
 #include <vector>
+#include <deque>
+#include <random>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <unistd.h>
 
 using namespace std;
 using namespace rapidjson;
 
 bool debug = false;
+CrawlTelemetry* telemetry = nullptr;    // --telemetry / --telemetry-live
 
-// Updated service URL
-const string SERVICE_URL = "http://hollywood-graph-crawler.bridgesuncc.org/neighbors/";
-
-// Function to HTTP ecnode parts of URLs. for instance, replace spaces with '%20' for URLs
-string url_encode(CURL* curl, string input) {
-  char* out = curl_easy_escape(curl, input.c_str(), input.size());
-  string s = out;
-  curl_free(out);
-  return s;
-}
-
-// Callback function for writing response data
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, string* output) {
-    size_t totalSize = size * nmemb;
-    output->append((char*)contents, totalSize);
-    return totalSize;
+// Updated service URL; HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+string service_url() {
+    const char* root = getenv("HOLLYWOOD_SERVICE_URL");
+    return string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
 }
-
-// Function to fetch neighbors using libcurl with debugging
-string fetch_neighbors(CURL* curl, const string& node) {
-
-    string url = SERVICE_URL + url_encode(curl, node);
-    string response;
-
+const string SERVICE_URL = service_url();
+
+// Requests in flight: start where the fixed thread count used to be, let the controller adapt
+const int INITIAL_CONCURRENCY = 8;
+const int DEFAULT_MAX_CONCURRENCY = 64;
+
+// Function to stream the neighbors of a node to on_neighbor, one name at a time, as they are
+// parsed out of the response. A failed request is retried with backoff, names its attempts have
+// forwarded already are dropped by the visited set; one that still fails yields no more
+// neighbors, a malformed one throws. The handle comes from the pool, its parser is reused for
+// all of its requests.
+void get_neighbors(ConnectionPool& pool, ConcurrencyController& controller, CURL* curl, const string& node, const function<void(const char*, size_t)>& on_neighbor) {
     if (debug)
-      cout << "Sending request to: " << url << endl;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L); // Verbose Logging
-
-    // Set a User-Agent header to avoid potential blocking by the server
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "User-Agent: C++-Client/1.0");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-
-    CURLcode res = curl_easy_perform(curl);
-
-    if (res != CURLE_OK) {
-        cerr << "CURL error: " << curl_easy_strerror(res) << endl;
-    } else {
-      if (debug)
+        cout << "Sending request for: " << node << endl;
+
+    RequestResult r = fetch_neighbors_blocking(pool, curl, SERVICE_URL, node, on_neighbor, RetryPolicy(), &controller,
+                                               [](CURL* handle, const RequestResult& attempt) {
+        if (telemetry) {
+            telemetry->record_transfer(handle);
+            if (attempt.ok)
+                telemetry->record(CrawlTelemetry::PARSE, FetchBuffers::of(handle).stream.parse_time());
+        }
+    });
+
+    const NeighborStream& stream = FetchBuffers::of(curl).stream;
+    if (r.malformed)
+        throw ParseException(stream.error_code(), GetParseError_En(stream.error_code()), stream.error_offset());
+    if (!r.ok) {
+        cerr << "CURL error: " << curl_easy_strerror(r.code) << endl;
+    } else if (debug) {
         cout << "CURL request successful!" << endl;
     }
-
-    // Cleanup
-    curl_slist_free_all(headers);
-
-    if (debug) 
-      cout << "Response received: " << response << endl;  // Debug log
-
-    return (res == CURLE_OK) ? response : "{}";
-}
-
-// Function to parse JSON and extract neighbors
-vector<string> get_neighbors(const string& json_str) {
-    vector<string> neighbors;
-    try {
-      Document doc;
-      doc.Parse(json_str.c_str());
-      
-      if (doc.HasMember("neighbors") && doc["neighbors"].IsArray()) {
-        for (const auto& neighbor : doc["neighbors"].GetArray())
-	  neighbors.push_back(neighbor.GetString());
-      }
-    } catch (const ParseException& e) {
-      std::cerr<<"Error while parsing JSON: "<<json_str<<std::endl;
-      throw e;
-    }
-    return neighbors;
 }
 
 /** // old BFS
@@ -142,92 +122,348 @@ vector<string> bfs(CURL* curl, const string& start, int depth) {
 }
 **/
 
-// BFS Traversal Function parallel version
-vector<string> bfs(CURL* curl, const string& start, int depth) {
-    struct Task {
-        string node;
-        int level;
+// Takes m, timing the wait if telemetry is on
+unique_lock<mutex> lock_timed(mutex& m) {
+    return telemetry ? telemetry->lock(m) : unique_lock<mutex>(m);
+}
+
+// Tasks point into the visited set, which interns every name exactly once, or with a visited
+// budget own their name until they are done
+struct Task {
+    const string* node;
+    int level;
+    uint32_t id = 0;    // discovery number in the checkpoint journal
+};
+
+// Numbers a batch of newly discovered nodes in the journal, in the order they are recorded
+void journal_discovered(CrawlJournal& journal, vector<Task>& batch) {
+    for (Task& task : batch)
+        task.id = journal.discovered(task.node->data(), task.node->size(), task.level);
+}
+
+// Work-stealing scheduler for the crawl workers. Every worker owns a deque: it pushes the
+// nodes it discovers there in batches and takes its next task from it, so the common path
+// only touches a lock no other worker is waiting on. An idle worker steals half of a random
+// victim's deque at once. Both sides take from the front, the oldest and shallowest nodes,
+// which keeps the crawl close to breadth-first order just like the shared queue did.
+//
+// Termination is a single atomic count of unfinished tasks: the nodes a task discovers are
+// added before the task itself is retired, so the count reaches zero exactly once, when the
+// last task finishes with nothing left queued. Workers only sleep after a failed round of
+// stealing, and a batch push wakes them only if one is asleep.
+class WorkStealingScheduler {
+public:
+    explicit WorkStealingScheduler(int workers) : deques(workers) {
+        for (int i = 0; i < workers; i++)
+            deques[i].rng.seed(i + 1);
+    }
+
+    // Queues the first tasks of the crawl, spread over the workers
+    void start(const vector<Task>& tasks) {
+        pending = tasks.size();
+        queued = tasks.size();
+        if (telemetry)
+            telemetry->frontier_changed(tasks.size());
+        for (size_t i = 0; i < tasks.size(); i++)
+            deques[i % deques.size()].tasks.push_back(tasks[i]);
+    }
+
+    // Queues a batch of discovered nodes on the worker's own deque
+    void push(int worker, vector<Task>& batch) {
+        if (batch.empty())
+            return;
+        const long n = batch.size();
+        pending += n;
+        {
+            WorkDeque& d = deques[worker];
+            unique_lock<mutex> lock = lock_timed(d.m);
+            d.tasks.insert(d.tasks.end(), batch.begin(), batch.end());
+        }
+        batch.clear();
+        queued += n;
+        if (telemetry)
+            telemetry->frontier_changed(n);
+        if (sleepers > 0)
+            wake_all();
+    }
+
+    // Gets the worker's next task, stealing or sleeping if it has none.
+    // Returns false once the whole crawl is done.
+    bool next(int worker, Task& task) {
+        while (true) {
+            if (pop(worker, task) || steal(worker, task)) {
+                queued--;
+                if (telemetry)
+                    telemetry->frontier_changed(-1);
+                return true;
+            }
+            if (pending == 0)
+                return false;
+
+            // Nothing anywhere: sleep until new work is pushed or the crawl ends. The sleeper
+            // is announced before queued is re-read, and a pusher bumps queued before it
+            // reads sleepers, so at least one of them sees the other.
+            unique_lock<mutex> lock(park_mutex);
+            sleepers++;
+            long seen = epoch;
+            if (queued == 0 && pending > 0) {
+                const auto idle_since = chrono::steady_clock::now();
+                park_cv.wait(lock, [&]() { return epoch != seen || pending == 0; });
+                if (telemetry)
+                    telemetry->record(CrawlTelemetry::IDLE, chrono::steady_clock::now() - idle_since);
+            }
+            sleepers--;
+        }
+    }
+
+    // Retires a task once all of its neighbors have been pushed
+    void finish() {
+        if (--pending == 0)
+            wake_all();
+    }
+
+    long steals() const { return steal_count; }
+
+private:
+    struct alignas(64) WorkDeque {
+        mutex m;
+        deque<Task> tasks;
+        minstd_rand rng;    // victim selection, only used by the owner
     };
 
-    queue<Task> q;
-    mutex q_mtx;
-    condition_variable cv;
+    bool pop(int worker, Task& task) {
+        WorkDeque& d = deques[worker];
+        unique_lock<mutex> lock = lock_timed(d.m);
+        if (d.tasks.empty())
+            return false;
+        task = d.tasks.front();
+        d.tasks.pop_front();
+        return true;
+    }
 
-    unordered_set<string> visited;
-    mutex visited_mtx;
-    vector<string> result;
+    // One pass over every other deque, starting at a random victim
+    bool steal(int worker, Task& task) {
+        const int n = deques.size();
+        if (n == 1)
+            return false;
+        WorkDeque& own = deques[worker];
+        int first = own.rng() % n;
+        for (int k = 0; k < n; k++) {
+            int victim = (first + k) % n;
+            if (victim == worker)
+                continue;
+
+            vector<Task> loot;
+            {
+                WorkDeque& d = deques[victim];
+                lock_guard<mutex> lock(d.m);
+                size_t take = (d.tasks.size() + 1) / 2;
+                loot.assign(d.tasks.begin(), d.tasks.begin() + take);
+                d.tasks.erase(d.tasks.begin(), d.tasks.begin() + take);
+            }
+            if (loot.empty())
+                continue;
+
+            steal_count++;
+            task = loot.front();
+            if (loot.size() > 1) {
+                lock_guard<mutex> lock(own.m);
+                own.tasks.insert(own.tasks.end(), loot.begin() + 1, loot.end());
+            }
+            return true;
+        }
+        return false;
+    }
 
-    int active_threads = 0;
-    bool done = false;
+    void wake_all() {
+        lock_guard<mutex> lock(park_mutex);
+        epoch++;
+        park_cv.notify_all();
+    }
 
-    q.push({start, 0});
-    visited.insert(start);
+    vector<WorkDeque> deques;
+    atomic<long> pending{0};    // tasks queued or being processed
+    atomic<long> queued{0};     // tasks sitting in a deque
+    atomic<int> sleepers{0};
+    atomic<long> steal_count{0};
 
-    const int THREADS = 8;
-    vector<thread> workers;
+    mutex park_mutex;
+    condition_variable park_cv;
+    long epoch = 0;             // bumped under park_mutex on every wake-up
+};
 
-    for (int i = 0; i < THREADS; ++i) {
-        workers.emplace_back([&]() {
-            CURL* mycurl = curl_easy_init();
-
-            while (true) {
-                Task task;
-                {
-                    unique_lock<mutex> lock(q_mtx);
-                    cv.wait(lock, [&]() { return !q.empty() || done; });
-                    if (q.empty() && done) break;
-                    if (q.empty()) continue;
-
-                    task = q.front();
-                    q.pop();
-                    active_threads++;
-                }
+// Visited set split into independently locked shards, so interning a name only contends with
+// workers that hit the same shard. Elements of an unordered_set never move, which keeps the
+// interned pointers valid for the whole crawl.
+//
+// With a budget, membership is decided by a VisitedNames kept within it instead, and a new name
+// is copied out for its task alone. The task hands it back with release() once it has been
+// expanded, so RAM beyond the budget only holds the names still queued.
+class VisitedSet {
+public:
+    VisitedSet(size_t budget_bytes, const string& spill_dir) {
+        if (budget_bytes)
+            bounded.reset(new VisitedNames(budget_bytes, spill_dir));
+    }
 
-                {
-                    lock_guard<mutex> lock(visited_mtx);
-                    result.push_back(task.node);
-                }
+    // Returns the interned name if it was not seen before, nullptr otherwise
+    const string* insert(const char* name, size_t len) {
+        if (bounded) {
+            // A Bloom negative read without the lock means the name is almost surely new, so its
+            // copy is made before taking the lock rather than under it. Only the locked insert
+            // decides, since another worker may be adding the same name.
+            const uint64_t h = VisitedNames::hash(name, len);
+            string* copy = bounded->may_contain(h) ? nullptr : new string(name, len);
+            bool inserted;
+            {
+                unique_lock<mutex> lock = lock_timed(bounded_m);
+                inserted = bounded->insert(name, len, h);
+            }
+            if (!inserted) {
+                delete copy;
+                return nullptr;
+            }
+            if (!copy)
+                copy = new string(name, len);
+            const size_t bytes = held_bytes.fetch_add(name_bytes(*copy)) + name_bytes(*copy);
+            size_t peak = peak_bytes.load();
+            while (bytes > peak && !peak_bytes.compare_exchange_weak(peak, bytes)) {}
+            return copy;
+        }
+        Shard& s = shards[hash<string_view>()(string_view(name, len)) % SHARDS];
+        unique_lock<mutex> lock = lock_timed(s.m);
+        auto inserted = s.names.emplace(name, len);
+        return inserted.second ? &*inserted.first : nullptr;
+    }
+
+    // Called once the task holding name is done with it; the shards keep theirs
+    void release(const string* name) {
+        if (!bounded || !name)
+            return;
+        held_bytes.fetch_sub(name_bytes(*name));
+        delete name;
+    }
+
+    void print_summary(ostream& out) const {
+        if (!bounded)
+            return;
+        const double mb = 1024.0 * 1024.0;
+        bounded->print_summary(out);
+        const ios::fmtflags flags = out.flags();
+        const streamsize precision = out.precision();
+        out << fixed << setprecision(2) << "  task names: " << peak_bytes.load() / mb << " MB at the peak, so "
+            << (bounded->memory_bytes() + peak_bytes.load()) / mb << " MB of RAM in all\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    static const int SHARDS = 64;
+
+    struct alignas(64) Shard {
+        mutex m;
+        unordered_set<string> names;
+    };
+
+    Shard shards[SHARDS];
+
+    // libstdc++ keeps up to 15 characters inside the string itself
+    static size_t name_bytes(const string& name) {
+        return sizeof(string) + (name.capacity() > 15 ? name.capacity() + 1 : 0);
+    }
+
+    unique_ptr<VisitedNames> bounded;
+    mutex bounded_m;            // Protects bounded
+    atomic<size_t> held_bytes{0}, peak_bytes{0};    // task names not yet released
+};
+
+// BFS Traversal Function parallel version
+// Nodes are final once discovered, so they go to out batch by batch in discovery order
+void bfs(ConnectionPool& pool, ConcurrencyController& controller, VisitedSet& visited, NodeWriter& out,
+         const string& start, int depth, CrawlJournal* journal) {
+    // Discovered nodes are handed to the scheduler this many at a time
+    const size_t PUSH_BATCH = 32;
+
+    // One worker per slot the window may ever open; the controller decides how many are fetching
+    const int THREADS = controller.max_window();
+    WorkStealingScheduler scheduler(THREADS);
+
+    vector<thread> workers;
+
+    // A resumed crawl starts from every node the journal has not seen expanded
+    vector<Task> initial;
+    if (journal && !journal->recovered().empty()) {
+        const vector<CrawlJournal::Entry>& entries = journal->recovered();
+        for (uint32_t id = 0; id < entries.size(); id++) {
+            const CrawlJournal::Entry& e = entries[id];
+            Task task = {visited.insert(e.name.data(), e.name.size()), e.level, id};
+            out.write(e.level, vector<string>(1, e.name));
+            if (!e.expanded && e.level < depth)
+                initial.push_back(task);
+            else
+                visited.release(task.node);
+        }
+    } else {
+        initial.push_back({visited.insert(start.data(), start.size()), 0});
+        if (journal)
+            journal_discovered(*journal, initial);
+        out.write(0, vector<string>(1, start));
+    }
+    scheduler.start(initial);
 
+    for (int i = 0; i < THREADS; ++i) {
+        workers.emplace_back([&, i]() {
+            CURL* mycurl = pool.acquire();   // persistent handle, reused for every request
+            vector<Task> batch;
+            batch.reserve(PUSH_BATCH);
+            vector<string> names;
+            auto push_batch = [&]() {
+                if (batch.empty())
+                    return;
+                if (journal)
+                    journal_discovered(*journal, batch);
+                for (const Task& found : batch)
+                    names.push_back(*found.node);
+                out.write(batch[0].level, move(names));
+                names.clear();
+                scheduler.push(i, batch);
+            };
+
+            Task task;
+            while (scheduler.next(i, task)) {
                 if (task.level < depth) {
-                    vector<string> neighbors = get_neighbors(fetch_neighbors(mycurl, task.node));
-                    for (const auto& neighbor : neighbors) {
-                        bool insert = false;
-                        {
-                            lock_guard<mutex> lock(visited_mtx);
-                            if (visited.find(neighbor) == visited.end()) {
-                                visited.insert(neighbor);
-                                insert = true;
-                            }
-                        }
-                        if (insert) {
-                            lock_guard<mutex> lock(q_mtx);
-                            q.push({neighbor, task.level + 1});
-                            cv.notify_one();
+                    // Flushing mid-response lets idle workers start on a large fan-out right away
+                    get_neighbors(pool, controller, mycurl, *task.node, [&](const char* name, size_t len) {
+                        if (const string* interned = visited.insert(name, len)) {
+                            batch.push_back({interned, task.level + 1});
+                            if (batch.size() >= PUSH_BATCH)
+                                push_batch();
                         }
-                    }
+                    });
+                    push_batch();
+                    if (journal)
+                        journal->expanded(task.id);
                 }
 
-                {
-                    lock_guard<mutex> lock(q_mtx);
-                    active_threads--;
-                    if (q.empty() && active_threads == 0) {
-                        done = true;
-                        cv.notify_all();
-                    }
-                }
+                visited.release(task.node);
+                scheduler.finish();
             }
 
-            curl_easy_cleanup(mycurl);
+            pool.release(mycurl);
         });
     }
 
     for (auto& t : workers) t.join();
-    return result;
+
+    if (debug)
+        cerr << "Work stealing: " << scheduler.steals() << " steals" << endl;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <node_name> <depth>\n";
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <node_name> <depth> [--http2] [--max-concurrency N] [--checkpoint FILE [--resume]]"
+             << " [--visited-budget MB] [--spill-dir DIR]"
+             << " [--output FILE] [--output-format text|jsonl|binary] [--telemetry FILE] [--telemetry-live SECONDS]\n";
         return 1;
     }
 
@@ -240,22 +476,126 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    CURL* curl = curl_easy_init();
-    if (!curl) {
+    bool http2 = false;
+    int max_concurrency = DEFAULT_MAX_CONCURRENCY;
+    string checkpoint;
+    bool resume = false;
+    size_t visited_budget = 0;
+    string spill_dir = "/tmp";
+    string output_path;
+    OutputFormat output_format = OutputFormat::TEXT;
+    string telemetry_path;
+    double telemetry_live = 0;      // seconds between live lines, 0 for none
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--http2") {
+            http2 = true;
+        } else if (arg == "--max-concurrency" && i + 1 < argc) {
+            max_concurrency = max(1, atoi(argv[++i]));
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint = argv[++i];
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--visited-budget" && i + 1 < argc) {
+            visited_budget = size_t(max(1L, atol(argv[++i]))) << 20;
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            spill_dir = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "--output-format" && i + 1 < argc && parse_output_format(argv[i + 1], output_format)) {
+            i++;
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            telemetry_path = argv[++i];
+        } else if (arg == "--telemetry-live" && i + 1 < argc) {
+            telemetry_live = max(0.1, atof(argv[++i]));
+        } else {
+            cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+    if (resume && checkpoint.empty()) {
+        cerr << "Error: --resume needs --checkpoint FILE\n";
+        return 1;
+    }
+
+    CrawlJournal* journal = nullptr;
+    if (!checkpoint.empty()) {
+        try {
+            journal = new CrawlJournal(checkpoint, start_node, depth, resume);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+        if (resume)
+            cerr << "Resuming with " << journal->recovered().size() << " nodes from " << checkpoint << "\n";
+    }
+
+    VisitedSet* visited;
+    try {
+        visited = new VisitedSet(visited_budget, spill_dir);
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
         cerr << "Failed to initialize CURL" << endl;
         return -1;
     }
+    ConnectionPool* pool = new ConnectionPool(SERVICE_URL, http2);
+    ConcurrencyController controller(INITIAL_CONCURRENCY, max_concurrency, debug);
+
+    NodeWriter* out;
+    cout.flush();
+    try {
+        out = new NodeWriter(output_path, output_format);
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
+
+    // Sampled once a second for the JSON timeline, or as often as the live line asks
+    if (!telemetry_path.empty() || telemetry_live > 0) {
+        telemetry = new CrawlTelemetry;
+        telemetry->on_sample = [&controller](CrawlTelemetry::Sample& s) {
+            s.in_flight = controller.requests_in_flight();
+            s.window = controller.window();
+        };
+        telemetry->start(telemetry_live > 0 ? telemetry_live : 1.0, telemetry_live > 0);
+    }
 
     const auto start{std::chrono::steady_clock::now()};
     
-    for (const auto& node : bfs(curl, start_node, depth))
-        cout << "- " << node << "\n";
+    bfs(*pool, controller, *visited, *out, start_node, depth, journal);
 
     const auto finish{std::chrono::steady_clock::now()};
     const std::chrono::duration<double> elapsed_seconds{finish - start};
+    out->close();
+    if (!out->ok())
+        cerr << "Error: could not write the output\n";
     std::cout << "Time to crawl: "<<elapsed_seconds.count() << "s\n";
+    out->print_summary(cout);
+    delete out;
+    pool->print_summary(cout);
+    controller.print_summary(cout);
+    visited->print_summary(cout);
+    if (telemetry) {
+        telemetry->stop();
+        if (!telemetry_path.empty()) {
+            ofstream tout(telemetry_path);
+            telemetry->write_json(tout);
+            if (tout)
+                cout << "Telemetry written to " << telemetry_path << "\n";
+            else
+                cerr << "Error: could not write " << telemetry_path << "\n";
+        }
+        delete telemetry;
+    }
     
-    curl_easy_cleanup(curl);
+    delete visited;
+    delete journal;
+    delete pool;
+    curl_global_cleanup();
 
     return 0;
 }
@@ -0,0 +1,30 @@
+#!/bin/bash
+
+#SBATCH --job-name=bfs_mock_benchmark
+#SBATCH --partition=Centaurus
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=16
+#SBATCH --time=01:00:00
+#SBATCH --mem=10G
+
+cd "$(dirname "$0")"
+
+echo "Compiling crawlers..."
+for dir in ../assignment3 ../MergeSort_Performance_Benchmark ../assignment4; do
+    make -C "$dir"
+    if [ $? -ne 0 ]; then
+        echo "Compilation failed in $dir!"
+        exit 1
+    fi
+done
+
+echo "Running crawlers against a fast server..."
+./harness.py --depths 1 2 3 > results_fast.txt
+
+echo "Running crawlers against a server with 40ms lognormal latency and 2% 1s stragglers..."
+./harness.py --depths 1 2 3 --latency lognormal:40,0.6 --straggler-rate 0.02 > results_slow.txt
+
+echo "Running crawlers against a server failing 2% of requests..."
+./harness.py --depths 2 3 --latency lognormal:40,0.6 --error-rate 0.02 > results_errors.txt
+
+echo "All benchmarks completed!"
@@ -0,0 +1,125 @@
+#!/usr/bin/env python3
+"""Runs every crawler against the local mock server and reports, for each crawler and
+depth, the wall time, the requests per second and the latency per BFS level.
+
+Latencies are measured by the server, from the moment a request is parsed to the last
+byte written (injected delays included). Any option the harness does not know is passed
+on to mock_server.py, e.g.
+
+    ./harness.py --depths 2 3 --latency lognormal:40,0.6 --straggler-rate 0.02
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+import urllib.parse
+import urllib.request
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.dirname(HERE)
+
+# name, binary relative to the repository root
+CRAWLERS = [
+    ("bfs", "assignment3/bfs"),
+    ("client", "MergeSort_Performance_Benchmark/client"),
+    ("client_parallel", "MergeSort_Performance_Benchmark/client_parallel"),
+    ("level_client", "assignment4/level_client"),
+    ("par_level_client", "assignment4/par_level_client"),
+]
+
+
+def percentile(values, q):
+    if not values:
+        return 0.0
+    values = sorted(values)
+    return values[min(len(values) - 1, int(q * len(values)))]
+
+
+def get_json(url):
+    with urllib.request.urlopen(url, timeout=30) as response:
+        return json.load(response)
+
+
+def wait_for_server(root, process):
+    for _ in range(600):
+        if process.poll() is not None:
+            sys.exit("mock server exited with status %d" % process.returncode)
+        try:
+            get_json(root + "/stats/reset")
+            return
+        except OSError:
+            time.sleep(0.1)
+    sys.exit("mock server did not come up")
+
+
+def run(binary, args, root, start, depth, timeout):
+    get_json(root + "/stats/reset")
+    env = dict(os.environ, HOLLYWOOD_SERVICE_URL=root)
+    began = time.monotonic()
+    try:
+        result = subprocess.run([binary, start, str(depth)] + args, env=env, timeout=timeout,
+                                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        status = result.returncode
+        nodes = sum(1 for line in result.stdout.splitlines() if line.strip())
+    except subprocess.TimeoutExpired:
+        status, nodes = "timeout", 0
+    wall = time.monotonic() - began
+    rows = get_json(root + "/stats?start=" + urllib.parse.quote(start))["requests"]
+    return wall, status, nodes, rows
+
+
+def report(name, depth, wall, status, nodes, rows, out):
+    errors = sum(1 for _, code, _ in rows if code != 200)
+    rate = len(rows) / wall if wall > 0 else 0.0
+    p99 = percentile([s for _, _, s in rows], 0.99) * 1000
+    out.write("%-18s depth %d  wall %8.3fs  %6d lines  %6d requests  %8.1f req/s  p99 %8.1f ms  %d errors%s\n"
+              % (name, depth, wall, nodes, len(rows), rate, p99, errors,
+                 "" if status == 0 else "  (exit %s)" % status))
+    for level in sorted({d for d, _, _ in rows}):
+        latencies = [s for d, _, s in rows if d == level]
+        out.write("%-18s   level %2d  %6d requests  p50 %8.1f ms  p99 %8.1f ms\n"
+                  % ("", level, len(latencies), percentile(latencies, 0.5) * 1000, percentile(latencies, 0.99) * 1000))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--start", default="Tom Hanks")
+    parser.add_argument("--depths", type=int, nargs="+", default=[1, 2, 3])
+    parser.add_argument("--crawlers", nargs="+", metavar="NAME", help="subset of: " + ", ".join(n for n, _ in CRAWLERS))
+    parser.add_argument("--crawler-args", default="", help="extra arguments for every crawler, e.g. \"--max-concurrency 32\"")
+    parser.add_argument("--repeat", type=int, default=1)
+    parser.add_argument("--timeout", type=float, default=600, help="seconds before a crawl is abandoned")
+    parser.add_argument("--bin-dir", help="look the crawler binaries up here instead of next to their sources")
+    parser.add_argument("--port", type=int, default=18090)
+    options, server_args = parser.parse_known_args()
+
+    root = "http://127.0.0.1:%d" % options.port
+    server = subprocess.Popen([sys.executable, os.path.join(HERE, "mock_server.py"), "--port", str(options.port)] + server_args)
+    try:
+        wait_for_server(root, server)
+        for name, path in CRAWLERS:
+            if options.crawlers and name not in options.crawlers:
+                continue
+            binary = os.path.join(options.bin_dir, os.path.basename(path)) if options.bin_dir else os.path.join(REPO, path)
+            if not os.access(binary, os.X_OK):
+                print("%-18s not built (%s), skipped" % (name, path))
+                continue
+            args = options.crawler_args.split()
+            # the crawlers without the option parser only take <node> <depth>
+            if name not in ("client_parallel", "par_level_client"):
+                args = []
+            for depth in options.depths:
+                for _ in range(options.repeat):
+                    wall, status, nodes, rows = run(binary, args, root, options.start, depth, options.timeout)
+                    report(name, depth, wall, status, nodes, rows, sys.stdout)
+                    sys.stdout.flush()
+    finally:
+        server.terminate()
+        server.wait()
+
+
+if __name__ == "__main__":
+    main()
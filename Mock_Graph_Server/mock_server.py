@@ -0,0 +1,265 @@
+#!/usr/bin/env python3
+"""Local stand-in for hollywood-graph-crawler.bridgesuncc.org.
+
+Serves GET /neighbors/<name> with the same JSON as the real service,
+{"node": <name>, "neighbors": [...]}, from a synthetic actor/movie graph or from a
+snapshot file, and can slow down or break responses on purpose so crawl timings are
+reproducible offline.
+
+Besides /neighbors/ the server answers:
+    GET /stats[?start=<name>]   every request served since the last reset, as
+                                [depth, status, seconds] rows; depth is the BFS distance
+                                of the requested node from <name> (-1 if unreachable)
+    GET /stats/reset            clears the request log
+"""
+
+import argparse
+import gzip
+import json
+import math
+import random
+import socket
+import sys
+import threading
+import time
+import urllib.parse
+from collections import deque
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+def synthetic_graph(actors, movies, cast_min, cast_max, seed):
+    """Bipartite actor/movie graph with a skewed cast distribution: actor i is picked with
+    weight 1/(i+20)^0.8, so a few actors (Tom Hanks and Matt Damon first) have a couple of
+    hundred movies while most have a handful, like the real data."""
+    rng = random.Random(seed)
+    names = ["Tom Hanks", "Matt Damon"] + ["Actor %d" % i for i in range(actors - 2)]
+    cumulative = []
+    total = 0.0
+    for i in range(len(names)):
+        total += 1.0 / (i + 20) ** 0.8
+        cumulative.append(total)
+
+    adjacency = {name: [] for name in names}
+    for m in range(movies):
+        movie = "Movie %d" % m
+        cast = set(rng.choices(names, cum_weights=cumulative, k=rng.randint(cast_min, cast_max)))
+        adjacency[movie] = sorted(cast)
+        for actor in cast:
+            adjacency[actor].append(movie)
+    return adjacency
+
+
+def load_graph(path):
+    """Reads a snapshot: either a JSON object mapping every node to its neighbor list, or
+    tab-separated edge lines "a<TAB>b" (edges are made symmetric)."""
+    with open(path, encoding="utf-8") as f:
+        text = f.read()
+    if text.lstrip().startswith("{"):
+        return json.loads(text)
+    adjacency = {}
+    for line in text.splitlines():
+        if not line.strip():
+            continue
+        a, b = line.rstrip("\n").split("\t")[:2]
+        adjacency.setdefault(a, []).append(b)
+        adjacency.setdefault(b, []).append(a)
+    return {node: sorted(set(neighbors)) for node, neighbors in adjacency.items()}
+
+
+def parse_latency(spec):
+    """Returns a function drawing one latency in seconds from a distribution given in ms:
+    "fixed:MS", "uniform:LO,HI", "normal:MEAN,SD", "lognormal:MEDIAN,SIGMA", "exp:MEAN"."""
+    kind, _, params = spec.partition(":")
+    values = [float(v) for v in params.split(",")] if params else []
+    if kind == "lognormal":
+        median, sigma = values[0] / 1000.0, values[1]   # sigma is unitless
+        return lambda rng: median * math.exp(rng.gauss(0.0, sigma))
+    values = [v / 1000.0 for v in values]
+    if kind == "fixed":
+        return lambda rng: values[0]
+    if kind == "uniform":
+        return lambda rng: rng.uniform(values[0], values[1])
+    if kind == "normal":
+        return lambda rng: max(0.0, rng.gauss(values[0], values[1]))
+    if kind == "exp":
+        return lambda rng: rng.expovariate(1.0 / values[0])
+    raise argparse.ArgumentTypeError("unknown latency distribution: " + spec)
+
+
+class RequestLog:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.entries = []   # (node, status, seconds)
+
+    def add(self, node, status, seconds):
+        with self.lock:
+            self.entries.append((node, status, seconds))
+
+    def reset(self):
+        with self.lock:
+            self.entries = []
+
+    def snapshot(self):
+        with self.lock:
+            return list(self.entries)
+
+
+def bfs_depths(adjacency, start):
+    depths = {start: 0}
+    queue = deque([start])
+    while queue:
+        node = queue.popleft()
+        for neighbor in adjacency.get(node, ()):
+            if neighbor not in depths:
+                depths[neighbor] = depths[node] + 1
+                queue.append(neighbor)
+    return depths
+
+
+class GraphHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"   # keep-alive, like the real service
+
+    # set by make_server()
+    adjacency = None
+    options = None
+    log = None
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        path, _, query = self.path.partition("?")
+        if path.startswith("/neighbors/"):
+            self.serve_neighbors(urllib.parse.unquote(path[len("/neighbors/"):]))
+        elif path == "/stats":
+            start = urllib.parse.parse_qs(query).get("start", [None])[0]
+            depths = bfs_depths(self.adjacency, start) if start is not None else {}
+            rows = [[depths.get(node, -1), status, seconds] for node, status, seconds in self.log.snapshot()]
+            self.send_body(200, json.dumps({"requests": rows}).encode())
+        elif path == "/stats/reset":
+            self.log.reset()
+            self.send_body(200, b"{}")
+        else:
+            self.send_body(404, json.dumps({"error": "Unknown endpoint"}).encode())
+
+    def serve_neighbors(self, node):
+        opts = self.options
+        rng = random.Random()
+        started = time.monotonic()
+
+        delay = opts.latency(rng)
+        if opts.straggler_rate and rng.random() < opts.straggler_rate:
+            delay += opts.straggler_ms / 1000.0
+
+        if opts.hang_rate and rng.random() < opts.hang_rate:
+            # never answer: the client has to time out, then the connection is dropped
+            time.sleep(opts.hang_ms / 1000.0)
+            self.log.add(node, 0, time.monotonic() - started)
+            self.close_connection = True
+            return
+
+        time.sleep(delay)
+
+        if opts.error_rate and rng.random() < opts.error_rate:
+            status = rng.choice(opts.error_codes)
+            self.send_body(status, json.dumps({"error": "Injected error"}).encode())
+            self.log.add(node, status, time.monotonic() - started)
+            return
+
+        body = json.dumps({"node": node, "neighbors": self.adjacency.get(node, [])}).encode()
+        if opts.malformed_rate and rng.random() < opts.malformed_rate:
+            body = body[:len(body) // 2]
+        self.send_body(200, body)
+        self.log.add(node, 200, time.monotonic() - started)
+
+    def send_body(self, status, body):
+        self.send_response(status)
+        self.send_header("Content-Type", "application/json")
+        if self.options and self.options.gzip and "gzip" in self.headers.get("Accept-Encoding", ""):
+            body = gzip.compress(body, compresslevel=6)
+            self.send_header("Content-Encoding", "gzip")
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        bandwidth = self.options.bandwidth if self.options else 0
+        if not bandwidth:
+            self.wfile.write(body)
+            return
+        # paced writes: about 50 chunks per second of the configured rate
+        chunk = max(1, bandwidth // 50)
+        try:
+            for i in range(0, len(body), chunk):
+                self.wfile.write(body[i:i + chunk])
+                self.wfile.flush()
+                time.sleep(len(body[i:i + chunk]) / bandwidth)
+        except (BrokenPipeError, ConnectionResetError):
+            self.close_connection = True
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+    request_queue_size = 1024   # the default backlog of 5 refuses connections under a parallel crawl
+
+    def server_bind(self):
+        self.socket.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        super().server_bind()
+
+
+def add_arguments(parser):
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--graph", default="synthetic",
+                        help='"synthetic" or a snapshot file (JSON adjacency or TSV edge list)')
+    parser.add_argument("--actors", type=int, default=20000)
+    parser.add_argument("--movies", type=int, default=8000)
+    parser.add_argument("--cast-min", type=int, default=2)
+    parser.add_argument("--cast-max", type=int, default=15)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--save-graph", metavar="FILE", help="write the graph as a JSON snapshot and exit")
+    parser.add_argument("--latency", type=parse_latency, default=parse_latency("fixed:0"),
+                        help='per-request latency in ms: "fixed:MS", "uniform:LO,HI", "normal:MEAN,SD", '
+                             '"lognormal:MEDIAN,SIGMA" or "exp:MEAN" (default no delay)')
+    parser.add_argument("--straggler-rate", type=float, default=0.0, help="fraction of requests delayed further")
+    parser.add_argument("--straggler-ms", type=float, default=1000.0)
+    parser.add_argument("--error-rate", type=float, default=0.0, help="fraction of requests answered with an error")
+    parser.add_argument("--error-codes", type=lambda s: [int(c) for c in s.split(",")], default=[500, 503, 429])
+    parser.add_argument("--hang-rate", type=float, default=0.0, help="fraction of requests never answered")
+    parser.add_argument("--hang-ms", type=float, default=60000.0, help="how long a hung request holds the connection")
+    parser.add_argument("--malformed-rate", type=float, default=0.0, help="fraction of responses cut in half")
+    parser.add_argument("--bandwidth", type=int, default=0, help="per-connection bytes/s (default unlimited)")
+    parser.add_argument("--gzip", action="store_true", help="gzip responses for clients that accept it")
+
+
+def build_graph(options):
+    if options.graph == "synthetic":
+        return synthetic_graph(options.actors, options.movies, options.cast_min, options.cast_max, options.seed)
+    return load_graph(options.graph)
+
+
+def make_server(options, adjacency):
+    handler = type("Handler", (GraphHandler,), {"adjacency": adjacency, "options": options, "log": RequestLog()})
+    return Server((options.host, options.port), handler)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    add_arguments(parser)
+    options = parser.parse_args()
+
+    adjacency = build_graph(options)
+    if options.save_graph:
+        with open(options.save_graph, "w", encoding="utf-8") as f:
+            json.dump(adjacency, f)
+        return
+
+    server = make_server(options, adjacency)
+    edges = sum(len(n) for n in adjacency.values()) // 2
+    print("Serving %d nodes, %d edges on http://%s:%d" % (len(adjacency), edges, options.host, server.server_port),
+          file=sys.stderr, flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
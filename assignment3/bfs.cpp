@@ -1,97 +1,63 @@
 #include <iostream>
 #include <queue>
+#include <string>
+#include <functional>
 #include <unordered_set>
+#include <cstdlib>
 #include <curl/curl.h>
-#include "rapidjson/document.h"
-#include "rapidjson/stringbuffer.h"
-#include "rapidjson/writer.h"
+#include "rapidjson/error/en.h"
+#include "neighbor_fetch.h"
 
-// Callback function to handle the data received from the HTTP request// Callback function to handle the data received from the HTTP request
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* s) {
-    size_t newLength = size * nmemb;
-    try {
-        s->append((char*)contents, newLength);  // Append the received data to the string
-    } catch (std::bad_alloc& e) {
+bool debug = false;
 
-        return 0;
-    }
-    return newLength;   // Return the number of bytes processed
+// HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+std::string service_url() {
+    const char* root = std::getenv("HOLLYWOOD_SERVICE_URL");
+    return std::string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
 }
+const std::string SERVICE_URL = service_url();
 
-// Function to encode a node name for use in a URL (e.g., replace spaces with %20) leaned from the discussion board
-std::string encode_url(const std::string& node) {
-    std::string encoded_node;
-    for (char ch : node) {
-        if (ch == ' ') {
-            encoded_node += "%20";
-        } else {
-            encoded_node += ch;
+// Function to fetch the neighbors of a given node from the web API on curl, a handle of pool that
+// keeps its connection (and DNS lookup) alive between requests. Each neighbor name is passed to
+// on_neighbor as soon as it has been parsed out of the response. A failed attempt is retried, so
+// names it got through before failing may be passed twice.
+void get_neighbors(ConnectionPool& pool, CURL* curl, const std::string& node, const std::function<void(const char*, size_t)>& on_neighbor) {
+    const RequestResult r = fetch_neighbors_blocking(pool, curl, SERVICE_URL, node, on_neighbor, RetryPolicy());
+    const NeighborStream& stream = FetchBuffers::of(curl).stream;
+    if (r.ok) {
+        if (!stream.api_error().empty()) {
+            std::cerr << "API Error: " << stream.api_error() << std::endl;
         }
+    } else if (r.malformed) {
+        std::cerr << "JSON Parse Error: " << rapidjson::GetParseError_En(stream.error_code())
+                  << " at offset " << stream.error_offset() << std::endl;
+    } else {
+        std::cerr << "CURL Error: " << curl_easy_strerror(r.code) << std::endl;
     }
-    return encoded_node;
+    if (debug)
+        std::cout << "Fetched neighbors of: " << node << std::endl;
 }
 
-// Function to fetch the neighbors of a given node from the web API
-std::unordered_set<std::string> get_neighbors(const std::string& node) {
-    std::unordered_set<std::string> neighbors;
-    CURL* curl = curl_easy_init();
-    if (curl) {
-        std::string url = "http://hollywood-graph-crawler.bridgesuncc.org/neighbors/" + encode_url(node);
-        curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-        std::string response;
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-        CURLcode res = curl_easy_perform(curl); // Perform the HTTP request
-        if (res == CURLE_OK) {
-
-            // Print the raw API response for debugging
-            std::cout << "API Response: " << response << std::endl;
-
-            rapidjson::Document doc;
-            doc.Parse(response.c_str());
-            if (doc.HasParseError()) {
-                std::cerr << "JSON Parse Error: " << doc.GetParseError() << std::endl;
-                return neighbors;
-            }
-            if (doc.HasMember("error")) {
-                std::cerr << "API Error: " << doc["error"].GetString() << std::endl;
-                return neighbors;
-            }
-            if (doc.HasMember("neighbors")) {
-                // Extract the list of neighbors from the JSON response
-                const rapidjson::Value& neighborsArray = doc["neighbors"];
-                for (rapidjson::SizeType i = 0; i < neighborsArray.Size(); i++) {
-                    neighbors.insert(neighborsArray[i].GetString());
-                }
-            }
-        } else {
-            std::cerr << "CURL Error: " << curl_easy_strerror(res) << std::endl;
-        }
-        curl_easy_cleanup(curl);
-    }
-    return neighbors;
-}
-
-// BFS function to traverse the graph
-std::unordered_set<std::string> bfs(const std::string& start_node, int depth) {
+// BFS function to traverse the graph. The visited set doubles as the string interner: names are
+// stored once, straight from the parser, and the queue only holds pointers into it.
+std::unordered_set<std::string> bfs(ConnectionPool& pool, CURL* curl, const std::string& start_node, int depth) {
     std::unordered_set<std::string> visited;
-    std::queue<std::pair<std::string, int>> queue;
-    queue.push({start_node, 0});
-    visited.insert(start_node);
+    std::queue<std::pair<const std::string*, int>> queue;
+    queue.push({&*visited.insert(start_node).first, 0});
 
     while (!queue.empty()) {
         auto current = queue.front();
         queue.pop();
-        std::string node = current.first;
+        const std::string& node = *current.first;
         int current_depth = current.second;
 
         if (current_depth < depth) {
-            for (const auto& neighbor : get_neighbors(node)) {
-                if (visited.find(neighbor) == visited.end()) {
-                    visited.insert(neighbor);
-                    queue.push({neighbor, current_depth + 1});
+            get_neighbors(pool, curl, node, [&](const char* name, size_t len) {
+                auto inserted = visited.emplace(name, len);
+                if (inserted.second) {
+                    queue.push({&*inserted.first, current_depth + 1});
                 }
-            }
+            });
         }
     }
 
@@ -108,7 +74,15 @@ int main(int argc, char* argv[]) {
     std::string start_node = argv[1];
     int depth = std::stoi(argv[2]);
 
-    auto result = bfs(start_node, depth);
+    ConnectionPool pool(SERVICE_URL);
+    CURL* curl = pool.acquire();
+    if (!curl) {
+        std::cerr << "Failed to initialize CURL" << std::endl;
+        return 1;
+    }
+
+    auto result = bfs(pool, curl, start_node, depth);
+    pool.release(curl);
 
     for (const auto& node : result) {
         std::cout << node << std::endl;
@@ -0,0 +1,143 @@
+// Analytics over a crawl snapshot written by par_level_client --export (graph_analytics.h):
+// degree distribution, connected components, PageRank and sampled betweenness, each timed.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <cstdlib>
+#include "graph_analytics.h"
+
+using namespace std;
+
+double seconds_since(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// The k nodes with the highest scores, best first
+vector<uint32_t> top_nodes(const vector<double>& scores, size_t k) {
+    vector<uint32_t> ids(scores.size());
+    iota(ids.begin(), ids.end(), 0);
+    k = min(k, ids.size());
+    partial_sort(ids.begin(), ids.begin() + k, ids.end(), [&](uint32_t a, uint32_t b) {
+        return scores[a] != scores[b] ? scores[a] > scores[b] : a < b;
+    });
+    ids.resize(k);
+    return ids;
+}
+
+void print_usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " <snapshot> [--top K] [--iterations N] [--damping D] [--tolerance T]\n"
+         << "       [--betweenness-samples N] [--seed S] [--scores FILE]\n";
+}
+
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+    if (argc < 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    string snapshot_path = argv[1], scores_path;
+    size_t top = 10;
+    int iterations = 100;
+    double damping = 0.85, tolerance = 1e-6;
+    uint64_t samples = 64, seed = 1;
+    for (int i = 2; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--top" && i + 1 < argc) {
+            top = atol(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            iterations = max(1, atoi(argv[++i]));
+        } else if (arg == "--damping" && i + 1 < argc) {
+            damping = atof(argv[++i]);
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (arg == "--betweenness-samples" && i + 1 < argc) {
+            samples = atoll(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            seed = atoll(argv[++i]);
+        } else if (arg == "--scores" && i + 1 < argc) {
+            scores_path = argv[++i];
+        } else {
+            cerr << "Error: Unknown option " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    try {
+        CrawlSnapshot snapshot(snapshot_path);
+        GraphAnalytics analytics(snapshot);
+        const uint64_t n = snapshot.num_nodes();
+        uint64_t expanded = 0;
+        for (uint64_t v = 0; v < n; v++)
+            expanded += snapshot.expanded(v);
+        cout << "Graph: " << n << " nodes (" << expanded << " expanded), " << snapshot.num_edges() << " adjacency entries";
+#ifdef _OPENMP
+        cout << ", " << omp_get_max_threads() << " threads";
+#endif
+        cout << "\n";
+
+        // Degree distribution in power-of-two buckets
+        auto start = chrono::steady_clock::now();
+        vector<uint64_t> degrees = analytics.degree_histogram();
+        double took = seconds_since(start);
+        cout << "\nDegrees (" << took << "s): max " << degrees.size() - 1 << ", mean " << (n ? (double)snapshot.num_edges() / n : 0.0) << "\n";
+        for (uint64_t low = 0, high = 1; low < degrees.size(); low = high, high *= 2) {
+            uint64_t count = 0;
+            for (uint64_t d = low; d < min<uint64_t>(high, degrees.size()); d++)
+                count += degrees[d];
+            if (count)
+                cout << "  [" << low << ", " << high << "): " << count << "\n";
+        }
+
+        start = chrono::steady_clock::now();
+        vector<uint32_t> component = analytics.connected_components();
+        took = seconds_since(start);
+        vector<uint64_t> sizes(n, 0);
+        for (uint32_t c : component)
+            sizes[c]++;
+        uint64_t components = 0, largest = 0, singletons = 0;
+        for (uint64_t s : sizes) {
+            components += s > 0;
+            singletons += s == 1;
+            largest = max(largest, s);
+        }
+        cout << "\nComponents (" << took << "s): " << components << ", the largest has " << largest << " nodes ("
+             << (n ? 100.0 * largest / n : 0.0) << "%), " << singletons << " isolated nodes\n";
+
+        start = chrono::steady_clock::now();
+        PageRankStats pr_stats;
+        vector<double> rank = analytics.pagerank(damping, iterations, tolerance, &pr_stats);
+        took = seconds_since(start);
+        cout << "\nPageRank (" << took << "s): " << pr_stats.iterations << " iterations, last change " << pr_stats.residual << "\n";
+        for (uint32_t v : top_nodes(rank, top))
+            cout << "  " << rank[v] << "\t" << snapshot.name(v) << "\n";
+
+        if (samples > 0) {
+            start = chrono::steady_clock::now();
+            vector<double> betweenness = analytics.approximate_betweenness(samples, seed);
+            took = seconds_since(start);
+            cout << "\nBetweenness (" << took << "s): estimated from " << min(samples, n) << " sources\n";
+            for (uint32_t v : top_nodes(betweenness, top))
+                cout << "  " << betweenness[v] << "\t" << snapshot.name(v) << "\n";
+        }
+
+        // PageRank in the format of par_level_client --scores, to steer a best-first crawl
+        if (!scores_path.empty()) {
+            ofstream out(scores_path);
+            for (uint64_t v = 0; v < n; v++)
+                out << snapshot.name(v) << "\t" << rank[v] << "\n";
+            if (!out.flush())
+                throw runtime_error("cannot write " + scores_path);
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+#ifndef CONCURRENCY_CONTROLLER_H
+#define CONCURRENCY_CONTROLLER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+
+// Adaptive limit on the number of requests in flight (AIMD, as in TCP congestion control).
+// While responses come back healthy the window grows by about one request per round trip; a
+// timeout, 429 or 5xx halves it, at most once per round trip since a burst of failures from
+// the same overloaded moment is one signal. A response counts as healthy while its latency
+// stays within twice the fastest one seen recently, so growth stops once the server queues.
+class ConcurrencyController {
+public:
+    enum Outcome { SUCCESS, CONGESTION, FAILURE, CANCELLED };
+
+    // verbose reports every cut of the window on stderr
+    ConcurrencyController(double initial, double max_window, bool verbose = false)
+        : verbose(verbose), current(std::min(initial, max_window)), limit(max_window), peak(current) {}
+
+    // Blocks until the window has room for one more request
+    void acquire() {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]() { return in_flight < (int)current; });
+        in_flight++;
+    }
+
+    // Takes a slot only if one is free right now (used for optional hedge requests)
+    bool try_acquire() {
+        std::lock_guard<std::mutex> lock(m);
+        if (in_flight >= (int)current)
+            return false;
+        in_flight++;
+        return true;
+    }
+
+    // Reports how the request went and gives its slot back. A cancelled request says nothing
+    // about the server and only frees the slot.
+    void release(double latency, Outcome outcome) {
+        std::lock_guard<std::mutex> lock(m);
+        in_flight--;
+        if (outcome == CANCELLED) {
+            cv.notify_one();
+            return;
+        }
+        int old_slots = (int)current;
+        auto now = std::chrono::steady_clock::now();
+
+        smoothed_latency = smoothed_latency == 0 ? latency : 0.875 * smoothed_latency + 0.125 * latency;
+        error_rate = 0.95 * error_rate + 0.05 * (outcome == SUCCESS ? 0.0 : 1.0);
+
+        if (outcome == SUCCESS) {
+            // Windowed minimum, so a server that got slower for good resets the baseline
+            if (now - epoch_start > std::chrono::seconds(10)) {
+                previous_min = epoch_min;
+                epoch_min = latency;
+                epoch_start = now;
+            }
+            epoch_min = std::min(epoch_min, latency);
+            double baseline = std::min(previous_min, epoch_min);
+            if (latency <= LATENCY_TOLERANCE * baseline && error_rate < MAX_ERROR_RATE)
+                current = std::min(limit, current + 1.0 / current);
+        } else if (outcome == CONGESTION) {
+            if (now - last_cut > std::chrono::duration<double>(smoothed_latency)) {
+                current = std::max(1.0, current * 0.5);
+                last_cut = now;
+                cuts++;
+                if (verbose)
+                    std::cerr << "Concurrency window cut to " << current << std::endl;
+            }
+        }
+        peak = std::max(peak, current);
+
+        if ((int)current > old_slots)
+            cv.notify_all();
+        else
+            cv.notify_one();
+    }
+
+    double window() const {
+        std::lock_guard<std::mutex> lock(m);
+        return current;
+    }
+
+    int max_window() const { return (int)limit; }
+
+    int requests_in_flight() const {
+        std::lock_guard<std::mutex> lock(m);
+        return in_flight;
+    }
+
+    void print_summary(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(m);
+        out << "Concurrency window: " << current << " (peak " << peak << ", limit " << limit
+            << ", " << cuts << " congestion cuts)\n";
+    }
+
+private:
+    static constexpr double LATENCY_TOLERANCE = 2.0;
+    static constexpr double MAX_ERROR_RATE = 0.05;
+
+    const bool verbose;
+    mutable std::mutex m;
+    std::condition_variable cv;
+    int in_flight = 0;
+    double current;
+    double limit;
+    double peak;
+    long cuts = 0;
+    double smoothed_latency = 0;
+    double error_rate = 0;
+    double epoch_min = 1e9;
+    double previous_min = 1e9;
+    std::chrono::steady_clock::time_point epoch_start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point last_cut;
+};
+
+#endif
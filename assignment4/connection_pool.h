@@ -0,0 +1,164 @@
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+// Keeps a crawl's connections warm. Every handle is configured once and then reused for the
+// whole crawl, so its keep-alive connection survives from one request to the next; all handles
+// share one DNS cache and one TLS session cache through a CURLSH. The connection cache itself
+// stays per handle: libcurl does not support using a shared connection from concurrent threads.
+//
+// Each handle carries its FetchBuffers, the URL buffer and response parser it reuses for every
+// request, through CURLOPT_PRIVATE. The pool's users must leave that option alone.
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "neighbor_stream.h"
+
+// What a handle needs for a request besides curl's own state, allocated once per handle and
+// found through CURLOPT_PRIVATE
+struct FetchBuffers {
+    NeighborStream stream;
+    std::string url;
+
+    static FetchBuffers& of(CURL* curl) {
+        char* p = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &p);
+        return *reinterpret_cast<FetchBuffers*>(p);
+    }
+};
+
+class ConnectionPool {
+public:
+    // service_url is where the handles will connect, which decides how HTTP/2 is negotiated
+    explicit ConnectionPool(const std::string& service_url, bool http2 = false)
+        : http2(http2), tls(service_url.compare(0, 8, "https://") == 0) {
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, share_mutexes);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+        // Set a User-Agent header to avoid potential blocking by the server
+        headers = curl_slist_append(nullptr, "User-Agent: C++-Client/1.0");
+    }
+
+    ~ConnectionPool() {
+        for (CURLM* multi : idle_multi)
+            curl_multi_cleanup(multi);
+        for (CURL* curl : idle) {
+            delete &FetchBuffers::of(curl);
+            curl_easy_cleanup(curl);
+        }
+        curl_share_cleanup(share);
+        curl_slist_free_all(headers);
+    }
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // Hands out an idle handle, or a freshly configured one if none is left
+    CURL* acquire() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            if (!idle.empty()) {
+                CURL* curl = idle.back();
+                idle.pop_back();
+                return curl;
+            }
+        }
+        CURL* curl = curl_easy_init();
+        if (!curl)
+            return nullptr;
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, NeighborStream::write_callback);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);   // HTTP errors are reported, not parsed
+        curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+        curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 600L);
+        curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);      // timeouts from any thread
+        // Offer every encoding this libcurl can decode (gzip, and br or zstd when built in); the
+        // write callback gets the decoded bytes
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, new FetchBuffers);
+        if (http2) {
+            // h2c with prior knowledge for plain http, negotiated through ALPN for https
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, tls ? CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+        // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L); // Verbose Logging
+        return curl;
+    }
+
+    // Returns a handle to the pool, its connection stays open for the next user
+    void release(CURL* curl) {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle.push_back(curl);
+    }
+
+    // Multi handles own the connection cache of the transfers they drive, so they are pooled
+    // as well: a worker that gets one back also gets its warm connections
+    CURLM* acquire_multi() {
+        {
+            std::lock_guard<std::mutex> lock(idle_mutex);
+            if (!idle_multi.empty()) {
+                CURLM* multi = idle_multi.back();
+                idle_multi.pop_back();
+                return multi;
+            }
+        }
+        CURLM* multi = curl_multi_init();
+        if (multi)
+            curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        return multi;
+    }
+
+    void release_multi(CURLM* multi) {
+        std::lock_guard<std::mutex> lock(idle_mutex);
+        idle_multi.push_back(multi);
+    }
+
+    // Called after every transfer; a transfer that needed no new connection reused one
+    void record(CURL* curl) {
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        requests++;
+        new_connections += connects;
+    }
+
+    void print_summary(std::ostream& out) const {
+        long n = requests, c = new_connections;
+        double reuse = n ? 100.0 * (n - std::min(c, n)) / n : 0.0;
+        out << "Connection reuse: " << reuse << "% (" << n << " requests, " << c << " new connections)\n";
+    }
+
+private:
+    // Lock callbacks for the share handle, one mutex per kind of shared data
+    static void share_lock(CURL*, curl_lock_data data, curl_lock_access, void* mutexes) {
+        static_cast<std::mutex*>(mutexes)[data].lock();
+    }
+
+    static void share_unlock(CURL*, curl_lock_data data, void* mutexes) {
+        static_cast<std::mutex*>(mutexes)[data].unlock();
+    }
+
+    const bool http2;
+    const bool tls;
+    CURLSH* share;
+    std::mutex share_mutexes[CURL_LOCK_DATA_LAST];
+    struct curl_slist* headers;
+    std::mutex idle_mutex;
+    std::vector<CURL*> idle;
+    std::vector<CURLM*> idle_multi;
+    std::atomic<long> requests{0};
+    std::atomic<long> new_connections{0};
+};
+
+#endif
@@ -0,0 +1,268 @@
+// Crawler written with C++20 coroutines (crawl_coro.h). Every node fetch is a coroutine that
+// suspends on its HTTP transfer, and BFS, path search and batches of queries are straight-line
+// coroutines on top of it. One thread and one curl_multi handle run them all.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <curl/curl.h>
+#include "rapidjson/error/en.h"
+#include "neighbor_fetch.h"
+#include "crawl_coro.h"
+
+using namespace std;
+using namespace rapidjson;
+
+// HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+string service_url() {
+    const char* root = getenv("HOLLYWOOD_SERVICE_URL");
+    return string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
+}
+const string SERVICE_URL = service_url();
+const int DEFAULT_MAX_CONCURRENCY = 64;
+
+struct ParseException : std::runtime_error, rapidjson::ParseResult {
+    ParseException(rapidjson::ParseErrorCode code, const char* msg, size_t offset) :
+        std::runtime_error(msg),
+        rapidjson::ParseResult(code, offset) {}
+};
+
+struct CrawlStats {
+    long fetched = 0;
+    long retried = 0;
+    long failed = 0;
+};
+
+// Neighbors of one node. Timeouts, connection errors, 429s and 5xx responses are retried after
+// a jittered exponential backoff; the wait suspends this coroutine only, never the thread.
+Task<vector<string>> fetch_neighbors(CurlScheduler& s, CrawlStats& stats, string node) {
+    const RetryPolicy policy;
+    vector<string> neighbors;
+    const function<void(const char*, size_t)> collect = [&neighbors](const char* name, size_t len) {
+        neighbors.emplace_back(name, len);
+    };
+    for (int attempt = 1;; attempt++) {
+        neighbors.clear();
+        const CurlScheduler::Completed done = co_await s.perform([&](CURL* curl) {
+            prepare_request(curl, SERVICE_URL, node, collect, policy.deadline_ms);
+        });
+        const RequestResult r = finish_request(done.curl, done.result);
+        const NeighborStream& stream = FetchBuffers::of(done.curl).stream;
+        const ParseErrorCode code = stream.error_code();
+        const size_t offset = stream.error_offset();
+        s.release(done.curl);
+        if (r.ok) {
+            stats.fetched++;
+            co_return neighbors;
+        }
+        if (r.malformed)
+            throw ParseException(code, GetParseError_En(code), offset);
+        if (!worth_retrying(policy, r) || attempt >= policy.max_attempts) {
+            cerr << "Failed to fetch neighbors of: " << node << " after " << attempt << " attempts" << endl;
+            stats.failed++;
+            co_return vector<string>();
+        }
+        stats.retried++;
+        co_await s.sleep(chrono::duration_cast<chrono::steady_clock::duration>(retry_backoff(policy, attempt)));
+    }
+}
+
+// Level-synchronous BFS: all nodes of a level are fetched concurrently, then merged in order,
+// so the levels come out exactly as with the threaded crawlers
+Task<vector<vector<string>>> bfs(CurlScheduler& s, CrawlStats& stats, string start, int depth) {
+    vector<vector<string>> levels{{start}};
+    unordered_set<string> visited{start};
+    for (int d = 0; d < depth; d++) {
+        vector<Task<vector<string>>> fetches;
+        for (const string& node : levels[d])
+            fetches.push_back(fetch_neighbors(s, stats, node));
+        vector<vector<string>> lists = co_await s.when_all(move(fetches));
+
+        vector<string> next;
+        for (const vector<string>& neighbors : lists)
+            for (const string& neighbor : neighbors)
+                if (visited.insert(neighbor).second)
+                    next.push_back(neighbor);
+        levels.push_back(move(next));
+    }
+    co_return levels;
+}
+
+// Bidirectional BFS for a shortest path of at most max_depth hops. Each round expands one level
+// of the side with the smaller frontier; the search stops at the first round where the sides meet.
+// Returns an empty path if there is none.
+Task<vector<string>> shortest_path(CurlScheduler& s, CrawlStats& stats, string source, string target, int max_depth) {
+    if (source == target)
+        co_return vector<string>{source};
+
+    unordered_map<string, string> parent[2];    // node -> the node it was reached from
+    vector<string> frontier[2] = {{source}, {target}};
+    parent[0][source] = "";
+    parent[1][target] = "";
+    int depth[2] = {0, 0};
+
+    while (depth[0] + depth[1] < max_depth && !frontier[0].empty() && !frontier[1].empty()) {
+        const int side = frontier[0].size() <= frontier[1].size() ? 0 : 1;
+        vector<Task<vector<string>>> fetches;
+        for (const string& node : frontier[side])
+            fetches.push_back(fetch_neighbors(s, stats, node));
+        vector<vector<string>> lists = co_await s.when_all(move(fetches));
+        depth[side]++;
+
+        vector<string> next;
+        const string* meeting = nullptr;
+        for (size_t i = 0; i < lists.size() && !meeting; i++) {
+            for (const string& neighbor : lists[i]) {
+                auto inserted = parent[side].emplace(neighbor, frontier[side][i]);
+                if (!inserted.second)
+                    continue;
+                if (parent[1 - side].count(neighbor)) {
+                    meeting = &inserted.first->first;
+                    break;
+                }
+                next.push_back(neighbor);
+            }
+        }
+        if (meeting) {
+            vector<string> path;
+            for (string node = *meeting; !node.empty(); node = parent[0][node])
+                path.insert(path.begin(), node);
+            for (string node = parent[1][*meeting]; !node.empty(); node = parent[1][node])
+                path.push_back(node);
+            co_return path;
+        }
+        frontier[side] = move(next);
+    }
+    co_return vector<string>();
+}
+
+// Answer to one query of a --queries batch, formatted once the query is done
+Task<string> answer(CurlScheduler& s, CrawlStats& stats, string node, int depth) {
+    vector<vector<string>> levels = co_await bfs(s, stats, node, depth);
+    ostringstream out;
+    size_t total = 0;
+    for (const vector<string>& level : levels)
+        total += level.size();
+    out << "# " << node << "\t" << depth << ": " << total << " nodes, level sizes";
+    for (const vector<string>& level : levels)
+        out << " " << level.size();
+    out << "\n";
+    co_return out.str();
+}
+
+// Runs every query of a file concurrently on the one event loop
+Task<vector<string>> run_queries(CurlScheduler& s, CrawlStats& stats, vector<pair<string, int>> queries) {
+    vector<Task<string>> tasks;
+    for (const auto& q : queries)
+        tasks.push_back(answer(s, stats, q.first, q.second));
+    co_return co_await s.when_all(move(tasks));
+}
+
+// Lines of "<node><TAB><depth>"
+vector<pair<string, int>> read_queries(const string& path) {
+    ifstream in(path);
+    if (!in)
+        throw runtime_error("cannot read " + path);
+    vector<pair<string, int>> queries;
+    string line;
+    while (getline(in, line)) {
+        size_t tab = line.rfind('\t');
+        if (line.empty() || tab == string::npos)
+            continue;
+        queries.emplace_back(line.substr(0, tab), atoi(line.c_str() + tab + 1));
+    }
+    return queries;
+}
+
+void print_usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " <node_name> <depth> [--path TARGET] [--max-concurrency N]\n"
+         << "       " << argv0 << " --queries FILE [--max-concurrency N]\n";
+}
+
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+
+    string start_node, target, queries_path;
+    int depth = 0;
+    int max_concurrency = DEFAULT_MAX_CONCURRENCY;
+    bool path_mode = false;
+
+    int i = 1;
+    if (argc >= 3 && string(argv[1]) == "--queries") {
+        queries_path = argv[2];
+        i = 3;
+    } else if (argc >= 3) {
+        start_node = argv[1];
+        try {
+            depth = stoi(argv[2]);
+        } catch (const exception&) {
+            cerr << "Error: Depth must be an integer.\n";
+            return 1;
+        }
+        i = 3;
+    } else {
+        print_usage(argv[0]);
+        return 1;
+    }
+    for (; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--path" && i + 1 < argc && queries_path.empty()) {
+            path_mode = true;
+            target = argv[++i];
+        } else if (arg == "--max-concurrency" && i + 1 < argc) {
+            max_concurrency = max(1, atoi(argv[++i]));
+        } else {
+            cerr << "Error: Unknown option " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    ConnectionPool pool(SERVICE_URL);
+    CurlScheduler scheduler(pool, max_concurrency);
+    CrawlStats stats;
+    const auto start = chrono::steady_clock::now();
+
+    try {
+        if (!queries_path.empty()) {
+            vector<pair<string, int>> queries = read_queries(queries_path);
+            for (const string& result : scheduler.run(run_queries(scheduler, stats, move(queries))))
+                cout << result;
+        } else if (path_mode) {
+            vector<string> path = scheduler.run(shortest_path(scheduler, stats, start_node, target, depth));
+            if (path.empty()) {
+                cout << "No path within " << depth << " hops\n";
+            } else {
+                for (const auto& node : path)
+                    cout << "- " << node << "\n";
+                cout << "Distance: " << path.size() - 1 << "\n";
+            }
+        } else {
+            for (const vector<string>& level : scheduler.run(bfs(scheduler, stats, start_node, depth))) {
+                for (const auto& node : level)
+                    cout << "- " << node << "\n";
+                cout << "Level size: " << level.size() << "\n";
+            }
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        curl_global_cleanup();
+        return 1;
+    }
+
+    const chrono::duration<double> elapsed_seconds = chrono::steady_clock::now() - start;
+    cout << "Time to crawl: " << elapsed_seconds.count() << "s\n";
+    cout << "Requests: " << scheduler.transfers() << " (" << stats.fetched << " nodes, " << stats.retried
+         << " retries, " << stats.failed << " failed) over " << scheduler.connections() << " connections, at most "
+         << scheduler.peak_in_flight() << " in flight\n";
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,153 @@
+// One crawler for benchmarking the others: any fetch backend with any traversal strategy
+// (crawler.h), the same output for all of them, and one timing report on stderr.
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <curl/curl.h>
+#include "crawler.h"
+
+using namespace std;
+
+// HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+string service_url() {
+    const char* root = getenv("HOLLYWOOD_SERVICE_URL");
+    return string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
+}
+
+unique_ptr<NeighborFetcher> make_fetcher(const string& backend, const FetchOptions& options) {
+    if (backend == "blocking")
+        return unique_ptr<NeighborFetcher>(new BlockingFetcher(options));
+    if (backend == "threads")
+        return unique_ptr<NeighborFetcher>(new ThreadPoolFetcher(options));
+    if (backend == "multi")
+        return unique_ptr<NeighborFetcher>(new MultiFetcher(options));
+    return nullptr;
+}
+
+void print_usage(const char* argv0) {
+    cerr << "Usage: " << argv0 << " <node_name> <depth> [--backend blocking|threads|multi]\n"
+         << "       [--strategy queue|level|bidirectional] [--target NODE] [--parallelism N]\n"
+         << "       [--retries N] [--timeout-ms MS] [--report FILE]\n";
+}
+
+int main(int argc, char* argv[]) {
+    ios::sync_with_stdio(false);
+    if (argc < 3) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    string start_node = argv[1];
+    int depth;
+    try {
+        depth = stoi(argv[2]);
+    } catch (const exception& e) {
+        cerr << "Error: Depth must be an integer.\n";
+        return 1;
+    }
+    if (depth < 0) {
+        cerr << "Error: Depth must be a non-negative integer.\n";
+        return 1;
+    }
+
+    string backend = "multi", strategy = "level", target, report_path;
+    FetchOptions options;
+    options.service_url = service_url();
+    for (int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--backend" && i + 1 < argc) {
+            backend = argv[++i];
+        } else if (arg == "--strategy" && i + 1 < argc) {
+            strategy = argv[++i];
+        } else if (arg == "--target" && i + 1 < argc) {
+            target = argv[++i];
+        } else if (arg == "--parallelism" && i + 1 < argc) {
+            options.parallelism = max(1, atoi(argv[++i]));
+        } else if (arg == "--retries" && i + 1 < argc) {
+            options.retries = max(0, atoi(argv[++i]));
+        } else if (arg == "--timeout-ms" && i + 1 < argc) {
+            options.timeout_ms = max(1L, atol(argv[++i]));
+        } else if (arg == "--report" && i + 1 < argc) {
+            report_path = argv[++i];
+        } else {
+            cerr << "Error: Unknown option " << arg << "\n";
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (strategy != "queue" && strategy != "level" && strategy != "bidirectional") {
+        cerr << "Error: Unknown strategy " << strategy << "\n";
+        return 1;
+    }
+    if ((strategy == "bidirectional") != !target.empty()) {
+        cerr << "Error: --target goes with --strategy bidirectional, and only with it\n";
+        return 1;
+    }
+
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    unique_ptr<NeighborFetcher> fetcher = make_fetcher(backend, options);
+    if (!fetcher) {
+        cerr << "Error: Unknown backend " << backend << "\n";
+        curl_global_cleanup();
+        return 1;
+    }
+
+    const auto start = chrono::steady_clock::now();
+    size_t nodes = 0;
+    if (strategy == "bidirectional") {
+        vector<string> path = bidirectional_path(*fetcher, start_node, target, depth);
+        if (path.empty()) {
+            cout << "No path within " << depth << " hops\n";
+        } else {
+            for (const auto& node : path)
+                cout << "- " << node << "\n";
+            cout << "Distance: " << path.size() - 1 << "\n";
+        }
+        nodes = path.size();
+    } else {
+        vector<vector<string>> levels = strategy == "queue" ? queue_bfs(*fetcher, start_node, depth)
+                                                            : level_bfs(*fetcher, start_node, depth);
+        for (const auto& level : levels) {
+            for (const auto& node : level)
+                cout << "- " << node << "\n";
+            cout << "Level size: " << level.size() << "\n";
+            nodes += level.size();
+        }
+    }
+    cout.flush();
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    FetchStats stats;
+    fetcher->add_stats(stats);
+    const double ms = 1e-6;
+    cerr << "Crawl: " << backend << " backend, " << strategy << " strategy, parallelism " << fetcher->parallelism() << "\n"
+         << "Time to crawl: " << elapsed.count() << "s\n"
+         << "Nodes: " << nodes << " output, " << stats.nodes << " fetched, " << stats.failed << " failed\n"
+         << "Requests: " << stats.requests << " (" << stats.retries << " retries) over " << stats.connections
+         << " connections, " << stats.bytes / 1e6 << " MB received, " << stats.requests / elapsed.count() << " requests/s\n"
+         << "Request latency: p50 " << stats.latency.percentile(0.50) * ms << "ms, p90 " << stats.latency.percentile(0.90) * ms
+         << "ms, p99 " << stats.latency.percentile(0.99) * ms << "ms, max " << stats.latency.max() * ms << "ms\n";
+
+    // One tab-separated line per run, so a sweep over backends and strategies is one table
+    if (!report_path.empty()) {
+        ofstream report(report_path, ios::app);
+        report << backend << "\t" << strategy << "\t" << fetcher->parallelism() << "\t" << start_node << "\t" << depth
+               << "\t" << elapsed.count() << "\t" << nodes << "\t" << stats.requests << "\t" << stats.retries << "\t"
+               << stats.failed << "\t" << stats.connections << "\t" << (long)stats.bytes << "\t"
+               << stats.latency.percentile(0.50) * ms << "\t" << stats.latency.percentile(0.99) * ms << "\n";
+        if (!report) {
+            cerr << "Error: cannot write " << report_path << "\n";
+            curl_global_cleanup();
+            return 1;
+        }
+    }
+
+    fetcher.reset();
+    curl_global_cleanup();
+    return 0;
+}
@@ -0,0 +1,398 @@
+#ifndef CRAWL_CORO_H
+#define CRAWL_CORO_H
+
+// C++20 coroutines on top of curl_multi. A crawl is written as straight-line code:
+//
+//     Task<vector<string>> neighbors(CurlScheduler& s, string node) {
+//         CurlScheduler::Completed done = co_await s.perform([&](CURL* curl) { prepare_request(curl, ...); });
+//         RequestResult r = finish_request(done.curl, done.result);
+//         s.release(done.curl);
+//         ...
+//     }
+//     vector<vector<string>> lists = co_await s.when_all(move(tasks));
+//
+// and one CurlScheduler drives every coroutine and every transfer from a single thread, on
+// handles of a ConnectionPool set up by the helpers of neighbor_fetch.h. A
+// suspended coroutine is just its frame on the heap, so thousands of logical crawls cost no
+// thread stacks and need no locks: coroutines only run between two steps of the event loop,
+// never concurrently.
+//
+// Task<T> is lazy: it starts when awaited, and resumes its awaiter directly when it finishes
+// (symmetric transfer), so chains of awaits don't grow the stack.
+
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "connection_pool.h"
+
+template <typename T>
+class Task;
+
+namespace detail {
+
+template <typename T>
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    // Hands control back to whoever awaited the task
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            std::coroutine_handle<> next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase<T> {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T v) { value = std::move(v); }
+    T result() {
+        if (this->error)
+            std::rethrow_exception(this->error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase<void> {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+// Fire-and-forget coroutine that frees itself when done; used to start children of when_all()
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+}  // namespace detail
+
+template <typename T = void>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(handle_type h) : h(h) {}
+    Task(Task&& other) noexcept : h(std::exchange(other.h, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (h)
+                h.destroy();
+            h = std::exchange(other.h, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (h)
+            h.destroy();
+    }
+
+    struct Awaiter {
+        handle_type h;
+        bool await_ready() const noexcept { return !h || h.done(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+            h.promise().continuation = awaiter;
+            return h;
+        }
+        T await_resume() { return h.promise().result(); }
+    };
+    Awaiter operator co_await() const noexcept { return Awaiter{h}; }
+
+    // Awaits the task's completion and leaves its result in place
+    struct DoneAwaiter : Awaiter {
+        void await_resume() const noexcept {}
+    };
+    DoneAwaiter done() const noexcept { return DoneAwaiter{{h}}; }
+
+    // Result of a finished task; rethrows its exception
+    T result() { return h.promise().result(); }
+
+private:
+    handle_type h;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+// Event loop of a crawl: a ready queue of coroutines, timers, and a curl_multi handle whose
+// transfers resume the coroutines waiting for them. At most max_in_flight transfers run at
+// once; the rest queue up in order. Not thread-safe: everything runs on the thread in run().
+class CurlScheduler {
+public:
+    // A finished transfer: the pool handle it ran on, which the coroutine hands back with
+    // release() once it is done with the response, and how it ended
+    struct Completed {
+        CURL* curl = nullptr;
+        CURLcode result = CURLE_OK;
+    };
+
+private:
+    struct Transfer {
+        std::function<void(CURL*)> prepare;
+        Completed completed;
+        std::coroutine_handle<> waiter;
+    };
+
+public:
+    CurlScheduler(ConnectionPool& pool, int max_in_flight)
+        : pool(pool), max_in_flight(max_in_flight), multi(curl_multi_init()) {
+        if (!multi)
+            throw std::runtime_error("cannot create a curl multi handle");
+        // Idle connections are kept for reuse by whichever transfer comes next
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)max_in_flight);
+    }
+
+    ~CurlScheduler() { curl_multi_cleanup(multi); }
+
+    CurlScheduler(const CurlScheduler&) = delete;
+    CurlScheduler& operator=(const CurlScheduler&) = delete;
+
+    // Runs a task and everything it starts to completion, returning its result
+    template <typename T>
+    T run(Task<T> task) {
+        bool done = false;
+        drive(task, done);
+        while (!done)
+            step();
+        return task.result();
+    }
+
+    // co_await perform(prepare) suspends the coroutine until the transfer is complete. Once a
+    // slot is free, prepare sets up a pool handle for the request, which then runs on it.
+    class Perform {
+    public:
+        Perform(CurlScheduler& s, std::function<void(CURL*)> prepare) : s(s) { t.prepare = std::move(prepare); }
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            t.waiter = h;
+            s.submit(&t);
+        }
+        Completed await_resume() const noexcept { return t.completed; }
+
+    private:
+        CurlScheduler& s;
+        Transfer t;
+    };
+    Perform perform(std::function<void(CURL*)> prepare) { return Perform(*this, std::move(prepare)); }
+
+    // Hands the handle of a completed transfer back to the pool
+    void release(CURL* curl) { pool.release(curl); }
+
+    // co_await sleep(d) resumes the coroutine once d has passed, without blocking the loop
+    class Sleep {
+    public:
+        Sleep(CurlScheduler& s, std::chrono::steady_clock::duration d) : s(s), until(std::chrono::steady_clock::now() + d) {}
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { s.timers.push({until, h}); }
+        void await_resume() const noexcept {}
+
+    private:
+        CurlScheduler& s;
+        std::chrono::steady_clock::time_point until;
+    };
+    Sleep sleep(std::chrono::steady_clock::duration d) { return Sleep(*this, d); }
+
+    // co_await when_all(tasks) runs the tasks concurrently and returns their results in order.
+    // The first exception thrown by one of them is rethrown once all have finished.
+    template <typename T>
+    class WhenAll {
+    public:
+        WhenAll(CurlScheduler& s, std::vector<Task<T>> tasks) : s(s), tasks(std::move(tasks)), results(this->tasks.size()) {}
+        bool await_ready() const noexcept { return tasks.empty(); }
+        void await_suspend(std::coroutine_handle<> h) {
+            waiter = h;
+            remaining = tasks.size();
+            for (size_t i = 0; i < tasks.size(); i++)
+                join(i);
+        }
+        std::vector<T> await_resume() {
+            if (error)
+                std::rethrow_exception(error);
+            std::vector<T> out;
+            out.reserve(results.size());
+            for (std::optional<T>& r : results)
+                out.push_back(std::move(*r));
+            return out;
+        }
+
+    private:
+        detail::Detached join(size_t i) {
+            try {
+                results[i] = co_await tasks[i];
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+            // Resumed from the loop rather than from here, where this frame is still running
+            if (--remaining == 0)
+                s.post(waiter);
+        }
+
+        CurlScheduler& s;
+        std::vector<Task<T>> tasks;
+        std::vector<std::optional<T>> results;
+        std::exception_ptr error;
+        size_t remaining = 0;
+        std::coroutine_handle<> waiter;
+    };
+    template <typename T>
+    WhenAll<T> when_all(std::vector<Task<T>> tasks) { return WhenAll<T>(*this, std::move(tasks)); }
+
+    // Queues a suspended coroutine to be resumed by the loop
+    void post(std::coroutine_handle<> h) { ready.push_back(h); }
+
+    long transfers() const { return completed; }
+    long connections() const { return connects; }
+    int peak_in_flight() const { return peak; }
+
+private:
+    struct Timer {
+        std::chrono::steady_clock::time_point until;
+        std::coroutine_handle<> waiter;
+        bool operator>(const Timer& other) const { return until > other.until; }
+    };
+
+    template <typename T>
+    detail::Detached drive(Task<T>& task, bool& done) {
+        co_await task.done();
+        done = true;
+    }
+
+    void submit(Transfer* t) {
+        if (in_flight < max_in_flight)
+            start(t);
+        else
+            waiting.push_back(t);
+    }
+
+    void start(Transfer* t) {
+        CURL* easy = pool.acquire();
+        if (!easy)
+            throw std::runtime_error("Failed to initialize CURL");
+        t->prepare(easy);
+        running[easy] = t;
+        curl_multi_add_handle(multi, easy);
+        in_flight++;
+        peak = std::max(peak, in_flight);
+    }
+
+    // Finished transfers wake their coroutines and free their slots for queued ones
+    void collect() {
+        int left;
+        while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            CURL* easy = msg->easy_handle;
+            auto found = running.find(easy);
+            Transfer* t = found->second;
+            running.erase(found);
+            t->completed.curl = easy;
+            t->completed.result = msg->data.result;
+            long new_connects = 0;
+            curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &new_connects);
+            connects += new_connects;
+            pool.record(easy);
+            curl_multi_remove_handle(multi, easy);
+            in_flight--;
+            completed++;
+            post(t->waiter);
+            if (!waiting.empty()) {
+                start(waiting.front());
+                waiting.pop_front();
+            }
+        }
+    }
+
+    // One turn of the loop: resume ready coroutines, expired timers, then advance transfers,
+    // sleeping in curl_multi_poll only when no coroutine is ready
+    void step() {
+        while (!ready.empty()) {
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+        const auto now = std::chrono::steady_clock::now();
+        while (!timers.empty() && timers.top().until <= now) {
+            post(timers.top().waiter);
+            timers.pop();
+        }
+        if (!ready.empty())
+            return;
+
+        int running;
+        curl_multi_perform(multi, &running);
+        collect();
+        if (!ready.empty())
+            return;
+
+        int wait_ms = 100;
+        if (!timers.empty()) {
+            auto until_timer = std::chrono::duration_cast<std::chrono::milliseconds>(timers.top().until - now).count();
+            wait_ms = std::max<int>(0, std::min<long long>(wait_ms, until_timer));
+        }
+        curl_multi_poll(multi, nullptr, 0, wait_ms, nullptr);
+    }
+
+    ConnectionPool& pool;
+    const int max_in_flight;
+    CURLM* multi;
+    std::unordered_map<CURL*, Transfer*> running;     // the pool owns CURLOPT_PRIVATE
+    std::deque<Transfer*> waiting;              // transfers beyond max_in_flight
+    std::deque<std::coroutine_handle<>> ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    int in_flight = 0;
+    int peak = 0;
+    long completed = 0;
+    long connects = 0;
+};
+
+#endif
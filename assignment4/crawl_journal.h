@@ -0,0 +1,182 @@
+#ifndef CRAWL_JOURNAL_H
+#define CRAWL_JOURNAL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+// Crash-safe record of a crawl's progress, so that an interrupted crawl can be resumed. The file
+// is a journal: a header naming the crawl, then one record per discovered node (level and name,
+// numbered in discovery order) and one per node whose neighbors have all been recorded (its
+// number). Records are appended to a buffer under a short lock and a background thread writes
+// and fsyncs the buffer every few seconds, so the workers never wait on the disk. A crash can
+// only lose the last few seconds, and a record torn by it is dropped on resume.
+class CrawlJournal {
+public:
+    struct Entry {
+        std::string name;
+        int level;
+        bool expanded;
+    };
+
+    // Opens the journal at path. With resume the crawl recorded there is read back first (it
+    // must be the same start and depth) and new records are appended to it; otherwise the file
+    // is started afresh. Throws std::runtime_error if the file can't be used.
+    CrawlJournal(const std::string& path, const std::string& start, int depth, bool resume) {
+        std::string header = "HGJRNL1";
+        header.push_back('\0');
+        put_varint(header, depth);
+        put_varint(header, start.size());
+        header += start;
+
+        if (resume) {
+            file = fopen(path.c_str(), "r+b");
+            if (!file)
+                throw std::runtime_error("cannot open checkpoint " + path);
+            std::string contents;
+            char chunk[1 << 16];
+            for (size_t n; (n = fread(chunk, 1, sizeof chunk, file)) > 0;)
+                contents.append(chunk, n);
+            if (contents.compare(0, header.size(), header) != 0) {
+                fclose(file);
+                throw std::runtime_error(path + " is not a checkpoint of this crawl (start and depth must match)");
+            }
+            size_t valid = replay(contents, header.size(), depth);
+            // Drop a torn last record before appending
+            if (ftruncate(fileno(file), valid) != 0 || fseek(file, valid, SEEK_SET) != 0) {
+                fclose(file);
+                throw std::runtime_error("cannot truncate checkpoint " + path);
+            }
+        } else {
+            file = fopen(path.c_str(), "wb");
+            if (!file)
+                throw std::runtime_error("cannot create checkpoint " + path);
+            fwrite(header.data(), 1, header.size(), file);
+            fflush(file);
+            written = header.size();
+        }
+        next_id = recovered_entries.size();
+        flusher = std::thread(&CrawlJournal::flush_loop, this);
+    }
+
+    ~CrawlJournal() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_one();
+        flusher.join();
+        fclose(file);
+    }
+
+    // What the journal held when it was opened with resume, indexed by node number
+    const std::vector<Entry>& recovered() const { return recovered_entries; }
+
+    // Records a newly discovered node and returns its number
+    uint32_t discovered(const char* name, size_t len, int level) {
+        std::lock_guard<std::mutex> lock(m);
+        buffer.push_back('D');
+        put_varint(buffer, level);
+        put_varint(buffer, len);
+        buffer.append(name, len);
+        return next_id++;
+    }
+
+    // Records that all neighbors of a node have been merged or queued
+    void expanded(uint32_t id) {
+        std::lock_guard<std::mutex> lock(m);
+        buffer.push_back('E');
+        put_varint(buffer, id);
+    }
+
+    long bytes_written() const {
+        std::lock_guard<std::mutex> lock(m);
+        return written;
+    }
+
+private:
+    static const int FLUSH_INTERVAL_S = 2;
+
+    static void put_varint(std::string& out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(char(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(char(v));
+    }
+
+    static bool get_varint(const std::string& in, size_t& pos, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+            unsigned char c = in[pos++];
+            v |= uint64_t(c & 0x7f) << shift;
+            if (!(c & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    // Rebuilds the entries from the records after the header; returns the end of the last
+    // complete record
+    size_t replay(const std::string& in, size_t pos, int depth) {
+        size_t valid = pos;
+        while (pos < in.size()) {
+            char type = in[pos++];
+            uint64_t a, b;
+            if (type == 'D' && get_varint(in, pos, a) && a <= uint64_t(depth) && get_varint(in, pos, b) && b <= in.size() - pos) {
+                recovered_entries.push_back({in.substr(pos, b), int(a), false});
+                pos += b;
+            } else if (type == 'E' && get_varint(in, pos, a) && a < recovered_entries.size()) {
+                recovered_entries[a].expanded = true;
+            } else {
+                break;
+            }
+            valid = pos;
+        }
+        written = valid;
+        return valid;
+    }
+
+    void flush_loop() {
+        std::unique_lock<std::mutex> lock(m);
+        for (;;) {
+            cv.wait_for(lock, std::chrono::seconds(FLUSH_INTERVAL_S), [&]() { return stopping; });
+            std::string pending;
+            pending.swap(buffer);
+            bool last = stopping;
+            lock.unlock();
+            if (!pending.empty()) {
+                fwrite(pending.data(), 1, pending.size(), file);
+                fflush(file);
+                fsync(fileno(file));
+            }
+            lock.lock();
+            written += pending.size();
+            if (last)
+                return;
+        }
+    }
+
+    mutable std::mutex m;   // Protects buffer, next_id, written and stopping
+    std::condition_variable cv;
+    FILE* file = nullptr;
+    std::string buffer;     // records not written yet
+    uint32_t next_id = 0;
+    long written = 0;
+    bool stopping = false;
+    std::vector<Entry> recovered_entries;
+    std::thread flusher;
+};
+
+const int CrawlJournal::FLUSH_INTERVAL_S;
+
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef CRAWL_SNAPSHOT_H
+#define CRAWL_SNAPSHOT_H
+
+// Binary CSR snapshot of a crawled subgraph. A crawl records the neighbor list of every node it
+// expanded in a SnapshotBuilder and writes it out once; later runs mmap the file with
+// CrawlSnapshot and answer BFS queries from it (direction_bfs.h) without parsing anything.
+//
+// Layout (native byte order, every section 8-byte aligned):
+//   SnapshotHeader
+//   uint64_t name_offsets[num_nodes + 1]     node i's name is names[name_offsets[i], name_offsets[i+1])
+//   char     names[names_bytes]
+//   uint32_t sorted[num_nodes]               node ids ordered by name, for lookups by binary search
+//   uint64_t adj_offsets[num_nodes + 1]      node i's neighbors are adjacency[adj_offsets[i], adj_offsets[i+1])
+//   uint32_t adjacency[num_edges]
+//   uint8_t  expanded[num_nodes]             1 if node i's neighbor list is complete
+//
+// Only expanded nodes were fetched, so only their lists are complete. The list of a node at the
+// edge of the crawl holds the expanded nodes that named it (the graph is undirected); it is kept
+// for queries that merely need to reach the node, but never stands in for a fetch.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t num_nodes;
+    uint64_t num_edges;         // adjacency entries, an edge between two expanded nodes counts twice
+    uint64_t names_bytes;
+    // byte offsets of the sections from the start of the file
+    uint64_t name_offsets;
+    uint64_t names;
+    uint64_t sorted;
+    uint64_t adj_offsets;
+    uint64_t adjacency;
+    uint64_t expanded;
+};
+
+static const char SNAPSHOT_MAGIC[8] = {'H', 'G', 'C', 'S', 'R', 0, 0, 0};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+// Collects the neighbor lists of the nodes a crawl expanded, from any number of threads
+class SnapshotBuilder {
+public:
+    // Records the complete neighbor list of an expanded node; duplicates are ignored
+    void add(const std::string& node, const std::vector<std::string>& neighbors) {
+        std::lock_guard<std::mutex> lock(m);
+        uint32_t u = id(node);
+        expanded[u] = 1;
+        lists[u].clear();
+        for (const std::string& name : neighbors) {
+            uint32_t v = id(name);      // may grow lists
+            lists[u].push_back(v);
+        }
+    }
+
+    size_t expanded_count() const {
+        std::lock_guard<std::mutex> lock(m);
+        return std::count(expanded.begin(), expanded.end(), 1);
+    }
+
+    // Writes the snapshot, throws std::runtime_error if the file can't be written
+    void write(const std::string& path) const {
+        std::lock_guard<std::mutex> lock(m);
+        const uint64_t n = names.size();
+
+        // Complete lists for expanded nodes, reverse edges for the others
+        std::vector<std::vector<uint32_t>> adj(n);
+        for (uint64_t u = 0; u < n; u++) {
+            if (!expanded[u])
+                continue;
+            adj[u] = lists[u];
+            for (uint32_t v : lists[u])
+                if (!expanded[v])
+                    adj[v].push_back(u);
+        }
+
+        SnapshotHeader header;
+        memset(&header, 0, sizeof header);
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof header.magic);
+        header.version = SNAPSHOT_VERSION;
+        header.num_nodes = n;
+
+        std::vector<uint64_t> name_offsets(n + 1, 0);
+        for (uint64_t i = 0; i < n; i++)
+            name_offsets[i + 1] = name_offsets[i] + names[i]->size();
+        header.names_bytes = name_offsets[n];
+
+        std::vector<uint32_t> sorted(n);
+        for (uint64_t i = 0; i < n; i++)
+            sorted[i] = i;
+        std::sort(sorted.begin(), sorted.end(), [&](uint32_t a, uint32_t b) { return *names[a] < *names[b]; });
+
+        std::vector<uint64_t> adj_offsets(n + 1, 0);
+        std::vector<uint32_t> adjacency;
+        for (uint64_t u = 0; u < n; u++) {
+            std::vector<uint32_t>& list = adj[u];
+            std::sort(list.begin(), list.end());
+            list.erase(std::unique(list.begin(), list.end()), list.end());
+            adjacency.insert(adjacency.end(), list.begin(), list.end());
+            adj_offsets[u + 1] = adjacency.size();
+        }
+        header.num_edges = adjacency.size();
+
+        uint64_t offset = align(sizeof header);
+        header.name_offsets = offset;   offset = align(offset + (n + 1) * sizeof(uint64_t));
+        header.names = offset;          offset = align(offset + header.names_bytes);
+        header.sorted = offset;         offset = align(offset + n * sizeof(uint32_t));
+        header.adj_offsets = offset;    offset = align(offset + (n + 1) * sizeof(uint64_t));
+        header.adjacency = offset;      offset = align(offset + adjacency.size() * sizeof(uint32_t));
+        header.expanded = offset;
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("cannot open " + path + " for writing");
+        out.write(reinterpret_cast<const char*>(&header), sizeof header);
+        pad(out, header.name_offsets);
+        out.write(reinterpret_cast<const char*>(name_offsets.data()), name_offsets.size() * sizeof(uint64_t));
+        pad(out, header.names);
+        for (const std::string* name : names)
+            out.write(name->data(), name->size());
+        pad(out, header.sorted);
+        out.write(reinterpret_cast<const char*>(sorted.data()), sorted.size() * sizeof(uint32_t));
+        pad(out, header.adj_offsets);
+        out.write(reinterpret_cast<const char*>(adj_offsets.data()), adj_offsets.size() * sizeof(uint64_t));
+        pad(out, header.adjacency);
+        out.write(reinterpret_cast<const char*>(adjacency.data()), adjacency.size() * sizeof(uint32_t));
+        pad(out, header.expanded);
+        out.write(reinterpret_cast<const char*>(expanded.data()), expanded.size());
+        if (!out.flush())
+            throw std::runtime_error("error while writing " + path);
+    }
+
+private:
+    static uint64_t align(uint64_t offset) { return (offset + 7) & ~uint64_t(7); }
+
+    static void pad(std::ofstream& out, uint64_t offset) {
+        static const char zeros[8] = {0};
+        out.write(zeros, offset - out.tellp());
+    }
+
+    // Interns a name (lock held)
+    uint32_t id(const std::string& name) {
+        auto inserted = ids.emplace(name, names.size());
+        if (inserted.second) {
+            names.push_back(&inserted.first->first);
+            lists.emplace_back();
+            expanded.push_back(0);
+        }
+        return inserted.first->second;
+    }
+
+    mutable std::mutex m;
+    std::unordered_map<std::string, uint32_t> ids;
+    std::vector<const std::string*> names;          // by id, pointing into ids
+    std::vector<std::vector<uint32_t>> lists;       // neighbor ids of expanded nodes
+    std::vector<uint8_t> expanded;
+};
+
+// Read-only view of a snapshot file. The file is mapped as is: loading checks the header and
+// that every section lies within the file, and nothing else is read until a query touches it.
+class CrawlSnapshot {
+public:
+    // Maps the file, throws std::runtime_error if it is missing or not a snapshot
+    explicit CrawlSnapshot(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("cannot open snapshot " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+            close(fd);
+            throw std::runtime_error(path + " is not a crawl snapshot");
+        }
+        size = st.st_size;
+        base = static_cast<const char*>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+        close(fd);
+        if (base == MAP_FAILED)
+            throw std::runtime_error("cannot map snapshot " + path);
+
+        header = reinterpret_cast<const SnapshotHeader*>(base);
+        const uint64_t n = header->num_nodes;
+        if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof header->magic) != 0 || header->version != SNAPSHOT_VERSION
+            || !fits(header->name_offsets, (n + 1) * sizeof(uint64_t)) || !fits(header->names, header->names_bytes)
+            || !fits(header->sorted, n * sizeof(uint32_t)) || !fits(header->adj_offsets, (n + 1) * sizeof(uint64_t))
+            || !fits(header->adjacency, header->num_edges * sizeof(uint32_t)) || !fits(header->expanded, n)) {
+            munmap(const_cast<char*>(base), size);
+            throw std::runtime_error(path + " is not a crawl snapshot");
+        }
+        name_offsets = reinterpret_cast<const uint64_t*>(base + header->name_offsets);
+        names = base + header->names;
+        sorted = reinterpret_cast<const uint32_t*>(base + header->sorted);
+        adj_offsets = reinterpret_cast<const uint64_t*>(base + header->adj_offsets);
+        adjacency = reinterpret_cast<const uint32_t*>(base + header->adjacency);
+        expanded_flags = reinterpret_cast<const uint8_t*>(base + header->expanded);
+    }
+
+    ~CrawlSnapshot() { munmap(const_cast<char*>(base), size); }
+
+    CrawlSnapshot(const CrawlSnapshot&) = delete;
+    CrawlSnapshot& operator=(const CrawlSnapshot&) = delete;
+
+    uint64_t num_nodes() const { return header->num_nodes; }
+    uint64_t num_edges() const { return header->num_edges; }
+
+    // Id of a node, or -1 if the snapshot does not know it
+    int64_t find(const char* name, size_t len) const {
+        uint64_t lo = 0, hi = header->num_nodes;
+        while (lo < hi) {
+            uint64_t mid = (lo + hi) / 2;
+            if (compare(sorted[mid], name, len) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo < header->num_nodes && compare(sorted[lo], name, len) == 0)
+            return sorted[lo];
+        return -1;
+    }
+
+    int64_t find(const std::string& name) const { return find(name.data(), name.size()); }
+
+    std::string name(uint32_t id) const {
+        return std::string(names + name_offsets[id], name_offsets[id + 1] - name_offsets[id]);
+    }
+
+    bool expanded(uint32_t id) const { return expanded_flags[id] != 0; }
+
+    const uint32_t* neighbors_begin(uint32_t id) const { return adjacency + adj_offsets[id]; }
+    const uint32_t* neighbors_end(uint32_t id) const { return adjacency + adj_offsets[id + 1]; }
+
+    // Streams the neighbors of node to on_neighbor if the snapshot holds its complete list;
+    // returns false, without calling on_neighbor, if the node has to be fetched instead
+    bool neighbors(const std::string& node, const std::function<void(const char*, size_t)>& on_neighbor) const {
+        int64_t u = find(node);
+        if (u < 0 || !expanded(u))
+            return false;
+        for (const uint32_t* v = neighbors_begin(u); v != neighbors_end(u); ++v)
+            on_neighbor(names + name_offsets[*v], name_offsets[*v + 1] - name_offsets[*v]);
+        return true;
+    }
+
+private:
+    bool fits(uint64_t offset, uint64_t bytes) const {
+        return offset % 8 == 0 && offset <= size && bytes <= size - offset;
+    }
+
+    int compare(uint32_t id, const char* name, size_t len) const {
+        size_t own = name_offsets[id + 1] - name_offsets[id];
+        int c = memcmp(names + name_offsets[id], name, std::min(own, len));
+        if (c != 0)
+            return c;
+        return own < len ? -1 : own > len ? 1 : 0;
+    }
+
+    const char* base;
+    size_t size;
+    const SnapshotHeader* header;
+    const uint64_t* name_offsets;
+    const char* names;
+    const uint32_t* sorted;
+    const uint64_t* adj_offsets;
+    const uint32_t* adjacency;
+    const uint8_t* expanded_flags;
+};
+
+#endif
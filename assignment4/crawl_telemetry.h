@@ -0,0 +1,376 @@
+#ifndef CRAWL_TELEMETRY_H
+#define CRAWL_TELEMETRY_H
+
+// Where a crawl's time goes. Every request's curl timings are split into DNS, connect, TLS,
+// time to first byte and transfer; the crawler adds its own parse times, lock waits and idle
+// waits. A sampler thread records requests/s, the frontier size and the request window over
+// time, optionally printing them as a live line on stderr. write_json() dumps all of it.
+//
+// Recording is cheap enough to leave on for real crawls. Each thread records into its own
+// shard of histograms, found through a thread_local pointer, so there are no shared cache lines
+// and no locks. A histogram is HDR-style: a power of two is split into 16 linear buckets, so a
+// value is off by at most 1/16 (6%) and a record is a bucket index computation and one
+// increment. Readers merge the shards, with relaxed atomics standing in for locks.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <curl/curl.h>
+
+// Counts of nanosecond values, from 0 to about 2^44 (4.9 hours)
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int MAX_BITS = 44;
+    static const int BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram() {
+        for (int i = 0; i < BUCKETS; i++)
+            counts[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Single writer: only the thread that owns the histogram may call this
+    void record(uint64_t ns) {
+        bump(counts[index(ns)], 1);
+        bump(total, 1);
+        bump(sum, ns);
+        if (ns > max_seen.load(std::memory_order_relaxed))
+            max_seen.store(ns, std::memory_order_relaxed);
+    }
+
+    // Adds another histogram's counts to this one (the caller owns this one)
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            uint64_t c = other.counts[i].load(std::memory_order_relaxed);
+            if (c)
+                bump(counts[i], c);
+        }
+        bump(total, other.total.load(std::memory_order_relaxed));
+        bump(sum, other.sum.load(std::memory_order_relaxed));
+        uint64_t m = other.max_seen.load(std::memory_order_relaxed);
+        if (m > max_seen.load(std::memory_order_relaxed))
+            max_seen.store(m, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const { return total.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_seen.load(std::memory_order_relaxed); }
+    double mean() const { return count() ? (double)sum.load(std::memory_order_relaxed) / count() : 0.0; }
+
+    // Upper end of the bucket holding the q-quantile, or the maximum if that is lower
+    uint64_t percentile(double q) const {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(q * (n - 1)) + 1, seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(upper(i), max());
+        }
+        return max();
+    }
+
+    // {"count": ..., "mean_us": ..., "p50_us": ..., ..., "buckets": [[upper_us, count], ...]}
+    // with the non-empty buckets only, in microseconds
+    void write_json(std::ostream& out) const {
+        out << "{\"count\": " << count() << ", \"mean_us\": " << mean() / 1e3 << ", \"p50_us\": " << percentile(0.50) / 1e3
+            << ", \"p90_us\": " << percentile(0.90) / 1e3 << ", \"p99_us\": " << percentile(0.99) / 1e3
+            << ", \"p999_us\": " << percentile(0.999) / 1e3 << ", \"max_us\": " << max() / 1e3 << ", \"buckets\": [";
+        bool first = true;
+        for (int i = 0; i < BUCKETS; i++) {
+            uint64_t c = counts[i].load(std::memory_order_relaxed);
+            if (!c)
+                continue;
+            out << (first ? "" : ", ") << "[" << upper(i) / 1e3 << ", " << c << "]";
+            first = false;
+        }
+        out << "]}";
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& a, uint64_t by) {
+        a.store(a.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    static int index(uint64_t v) {
+        if (v < (uint64_t)SUB_BUCKETS)
+            return (int)v;
+        int msb = 63 - __builtin_clzll(v);
+        if (msb >= MAX_BITS)
+            return BUCKETS - 1;
+        int shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_BUCKETS + (int)((v >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    static uint64_t upper(int i) {
+        if (i < SUB_BUCKETS)
+            return i;
+        int shift = i / SUB_BUCKETS - 1;
+        return ((uint64_t)(SUB_BUCKETS + i % SUB_BUCKETS + 1) << shift) - 1;
+    }
+
+    std::atomic<uint64_t> counts[BUCKETS];
+    std::atomic<uint64_t> total{0}, sum{0}, max_seen{0};
+};
+
+class CrawlTelemetry {
+public:
+    enum Metric {
+        DNS,            // name lookup, for requests that opened a connection
+        CONNECT,        // TCP handshake, same
+        TLS,            // TLS handshake, same
+        TTFB,           // request sent to first response byte
+        TRANSFER,       // first to last response byte
+        REQUEST,        // whole request as curl saw it
+        PARSE,          // parsing a response and handing its names to the crawl
+        LOCK_WAIT,      // acquiring the crawl's shared state (0 when uncontended)
+        IDLE,           // a worker waiting for work
+        NUM_METRICS
+    };
+
+    // What the sampler sees at one point in time
+    struct Sample {
+        double t = 0;               // seconds since the telemetry started
+        uint64_t requests = 0;
+        double requests_per_s = 0;  // since the previous sample
+        long frontier = 0;
+        long in_flight = -1;        // filled in by on_sample, -1 if it isn't
+        double window = -1;
+    };
+
+    // Fills in the gauges the telemetry can't see itself; called from the sampler thread
+    std::function<void(Sample&)> on_sample;
+
+    CrawlTelemetry() : started(std::chrono::steady_clock::now()), id(next_id()) {}
+    ~CrawlTelemetry() { stop(); }
+
+    CrawlTelemetry(const CrawlTelemetry&) = delete;
+    CrawlTelemetry& operator=(const CrawlTelemetry&) = delete;
+
+    // Samples every interval_s seconds, printing each sample to stderr if live is set
+    void start(double interval_s, bool live) {
+        interval = interval_s;
+        live_line = live;
+        sampler = std::thread(&CrawlTelemetry::sample_loop, this);
+    }
+
+    // Stops the sampler after taking a final sample; later calls do nothing
+    void stop() {
+        if (!sampler.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        cv.notify_all();
+        sampler.join();
+    }
+
+    void record(Metric metric, uint64_t ns) { local().histograms[metric].record(ns); }
+
+    void record(Metric metric, std::chrono::steady_clock::duration d) {
+        record(metric, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    // Records the timings of a finished transfer
+    void record_transfer(CURL* curl) {
+        curl_off_t lookup = 0, connect = 0, tls = 0, pretransfer = 0, first_byte = 0, total = 0, bytes = 0;
+        long connects = 0;
+        curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &lookup);
+        curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+        curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+        curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &pretransfer);
+        curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &first_byte);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+        // curl reports microseconds. A reused connection reports its setup as zero, which would
+        // only drown the real ones.
+        Shard& s = local();
+        if (connects > 0) {
+            s.histograms[DNS].record(lookup * 1000);
+            s.histograms[CONNECT].record((connect - lookup) * 1000);
+            if (tls > 0)
+                s.histograms[TLS].record((tls - connect) * 1000);
+        }
+        if (first_byte > 0) {
+            s.histograms[TTFB].record((first_byte - pretransfer) * 1000);
+            s.histograms[TRANSFER].record((total - first_byte) * 1000);
+        }
+        s.histograms[REQUEST].record(total * 1000);
+        s.bytes.store(s.bytes.load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+
+    // Nodes queued for expansion; crawls add what they queue and subtract what they take
+    void frontier_changed(long delta) { frontier.fetch_add(delta, std::memory_order_relaxed); }
+
+    // Takes m, recording how long that took as a LOCK_WAIT
+    std::unique_lock<std::mutex> lock(std::mutex& target) {
+        std::unique_lock<std::mutex> l(target, std::try_to_lock);
+        if (l.owns_lock()) {
+            record(LOCK_WAIT, (uint64_t)0);
+        } else {
+            auto before = std::chrono::steady_clock::now();
+            l.lock();
+            record(LOCK_WAIT, std::chrono::steady_clock::now() - before);
+        }
+        return l;
+    }
+
+    // Everything recorded so far, as one JSON object
+    void write_json(std::ostream& out) {
+        LatencyHistogram merged[NUM_METRICS];
+        uint64_t bytes = merge(merged);
+        std::vector<Sample> timeline;
+        {
+            std::lock_guard<std::mutex> lock(m);
+            timeline = samples;
+        }
+        const double elapsed = seconds_since_start();
+        const uint64_t requests = merged[REQUEST].count();
+
+        out << "{\n  \"elapsed_s\": " << elapsed << ",\n  \"threads\": " << num_shards() << ",\n  \"requests\": " << requests
+            << ",\n  \"requests_per_s\": " << (elapsed > 0 ? requests / elapsed : 0.0) << ",\n  \"bytes\": " << bytes
+            << ",\n  \"histograms\": {";
+        for (int i = 0; i < NUM_METRICS; i++) {
+            out << (i ? ",\n" : "\n") << "    \"" << metric_name(i) << "\": ";
+            merged[i].write_json(out);
+        }
+        out << "\n  },\n  \"timeline\": [";
+        for (size_t i = 0; i < timeline.size(); i++) {
+            const Sample& s = timeline[i];
+            out << (i ? ",\n" : "\n") << "    {\"t\": " << s.t << ", \"requests\": " << s.requests << ", \"requests_per_s\": "
+                << s.requests_per_s << ", \"frontier\": " << s.frontier;
+            if (s.in_flight >= 0)
+                out << ", \"in_flight\": " << s.in_flight;
+            if (s.window >= 0)
+                out << ", \"window\": " << s.window;
+            out << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    static const char* metric_name(int metric) {
+        static const char* const NAMES[NUM_METRICS] = {
+            "dns", "connect", "tls", "ttfb", "transfer", "request", "parse", "lock_wait", "idle"};
+        return NAMES[metric];
+    }
+
+    struct Shard {
+        LatencyHistogram histograms[NUM_METRICS];
+        std::atomic<uint64_t> bytes{0};
+    };
+
+    // The calling thread's shard, created on its first record
+    Shard& local() {
+        struct Cached {
+            uint64_t owner;
+            Shard* shard;
+        };
+        static thread_local Cached cached = {0, nullptr};
+        if (cached.owner != id) {
+            std::lock_guard<std::mutex> lock(m);
+            shards.emplace_back(new Shard);
+            cached.owner = id;
+            cached.shard = shards.back().get();
+        }
+        return *cached.shard;
+    }
+
+    // Identifies an instance for the thread_local shard cache, unlike its address
+    static uint64_t next_id() {
+        static std::atomic<uint64_t> last{0};
+        return ++last;
+    }
+
+    size_t num_shards() {
+        std::lock_guard<std::mutex> lock(m);
+        return shards.size();
+    }
+
+    // Sums every shard into merged; returns the bytes received
+    uint64_t merge(LatencyHistogram* merged) {
+        std::lock_guard<std::mutex> lock(m);
+        uint64_t bytes = 0;
+        for (const std::unique_ptr<Shard>& s : shards) {
+            for (int i = 0; i < NUM_METRICS; i++)
+                merged[i].merge(s->histograms[i]);
+            bytes += s->bytes.load(std::memory_order_relaxed);
+        }
+        return bytes;
+    }
+
+    double seconds_since_start() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    }
+
+    void sample_loop() {
+        uint64_t last_requests = 0;
+        double last_t = 0;
+        for (bool last = false; !last;) {
+            {
+                std::unique_lock<std::mutex> lock(m);
+                last = cv.wait_for(lock, std::chrono::duration<double>(interval), [&]() { return stopping; });
+            }
+            LatencyHistogram merged[NUM_METRICS];
+            merge(merged);
+            Sample s;
+            s.t = seconds_since_start();
+            s.requests = merged[REQUEST].count();
+            s.requests_per_s = s.t > last_t ? (s.requests - last_requests) / (s.t - last_t) : 0.0;
+            s.frontier = frontier.load(std::memory_order_relaxed);
+            if (on_sample)
+                on_sample(s);
+            last_requests = s.requests;
+            last_t = s.t;
+            {
+                std::lock_guard<std::mutex> lock(m);
+                samples.push_back(s);
+            }
+            if (live_line)
+                print_live(s, merged);
+        }
+    }
+
+    static void print_live(const Sample& s, const LatencyHistogram* h) {
+        char line[256];
+        int n = snprintf(line, sizeof(line),
+                         "[%.1fs] %llu requests (%.0f/s), frontier %ld, ttfb p50 %.1fms p99 %.1fms, parse p99 %.0fus, "
+                         "lock wait p99 %.1fus",
+                         s.t, (unsigned long long)s.requests, s.requests_per_s, s.frontier, h[TTFB].percentile(0.50) / 1e6,
+                         h[TTFB].percentile(0.99) / 1e6, h[PARSE].percentile(0.99) / 1e3, h[LOCK_WAIT].percentile(0.99) / 1e3);
+        if (s.in_flight >= 0 && n > 0 && n < (int)sizeof(line))
+            snprintf(line + n, sizeof(line) - n, ", %ld in flight (window %.1f)", s.in_flight, s.window);
+        fprintf(stderr, "%s\n", line);
+    }
+
+    const std::chrono::steady_clock::time_point started;
+    const uint64_t id;
+    std::atomic<long> frontier{0};
+
+    std::mutex m;       // Protects shards, samples and stopping
+    std::condition_variable cv;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::vector<Sample> samples;
+    bool stopping = false;
+
+    std::thread sampler;
+    double interval = 1.0;
+    bool live_line = false;
+};
+
+#endif
@@ -0,0 +1,422 @@
+#ifndef CRAWLER_H
+#define CRAWLER_H
+
+// The crawler as interchangeable parts, so the ways of crawling can be compared on equal terms.
+// A NeighborFetcher answers a batch of node names with their neighbor lists: one request after
+// another (BlockingFetcher), one blocking request per OpenMP thread (ThreadPoolFetcher), or
+// many transfers on one curl_multi handle (MultiFetcher). A traversal strategy decides which
+// batches to ask for: a FIFO queue served a window at a time (queue_bfs), whole levels
+// (level_bfs), or two frontiers growing towards each other (bidirectional_path).
+//
+// Every fetcher answers a batch in the order of its nodes, and every strategy merges the answers
+// in that order, so each combination produces the same levels as the sequential client. All
+// fetchers share the pooled handles, request setup and retry policy of neighbor_fetch.h and the
+// statistics below, and only the way requests are scheduled differs.
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+#include <omp.h>
+
+#include "crawl_telemetry.h"
+#include "neighbor_fetch.h"
+
+struct FetchOptions {
+    std::string service_url;        // prefix of every request, the node name is appended to it
+    int parallelism = 16;           // requests in flight (threads for ThreadPoolFetcher)
+    int retries = 3;                // after a timeout, connection error, 429, 5xx or bad JSON
+    long timeout_ms = 30000;
+};
+
+struct FetchStats {
+    long requests = 0;              // attempts, retries included
+    long nodes = 0;                 // nodes answered
+    long retries = 0;
+    long failed = 0;                // nodes given up on
+    long connections = 0;           // connections opened
+    double bytes = 0;               // as received, before any decompression
+    LatencyHistogram latency;       // of each attempt
+
+    void merge(const FetchStats& other) {
+        requests += other.requests;
+        nodes += other.nodes;
+        retries += other.retries;
+        failed += other.failed;
+        connections += other.connections;
+        bytes += other.bytes;
+        latency.merge(other.latency);
+    }
+};
+
+// A handle of the fetcher's pool, with the node list its requests fill. Names are parsed out of
+// the response as it arrives, straight into the node's list.
+class FetchHandle {
+public:
+    enum Outcome { DONE, RETRY, FAILED };
+
+    // Which node of the batch this handle is fetching, and which attempt it is; kept here
+    // for MultiFetcher, which finds the handle again from the CURL*
+    size_t index = 0;
+    int attempt = 0;
+
+    FetchHandle(ConnectionPool& pool, const FetchOptions& options, const RetryPolicy& policy)
+        : pool(pool), options(options), policy(policy) {
+        collect = [this](const char* name, size_t len) { neighbors->emplace_back(name, len); };
+        curl = pool.acquire();
+        if (!curl)
+            throw std::runtime_error("Failed to initialize CURL");
+    }
+    ~FetchHandle() { pool.release(curl); }
+
+    FetchHandle(const FetchHandle&) = delete;
+    FetchHandle& operator=(const FetchHandle&) = delete;
+
+    CURL* get() const { return curl; }
+
+    // Points the handle at a node's neighbor list, whose names go to list
+    void prepare(const std::string& node, std::vector<std::string>& list) {
+        neighbors = &list;
+        neighbors->clear();
+        prepare_request(curl, options.service_url, node, collect, policy.deadline_ms);
+    }
+
+    // Accounts for a finished attempt, leaving the node's list empty unless it succeeded.
+    // Transient failures are retried until the retries run out, anything else fails the node
+    // at once.
+    Outcome finish(CURLcode result, const std::string& node, FetchStats& stats) {
+        long connects = 0;
+        curl_off_t total_us = 0, received = 0;
+        curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+        curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total_us);
+        curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &received);
+        stats.requests++;
+        stats.connections += connects;
+        stats.bytes += received;
+        stats.latency.record((uint64_t)total_us * 1000);
+
+        const RequestResult r = finish_request(curl, result);
+        if (r.ok) {
+            stats.nodes++;
+            return DONE;
+        }
+        neighbors->clear();
+        if (worth_retrying(policy, r) && attempt + 1 < policy.max_attempts) {
+            stats.retries++;
+            return RETRY;
+        }
+        std::cerr << "Failed to fetch neighbors of: " << node << " after " << attempt + 1 << " attempts" << std::endl;
+        stats.failed++;
+        return FAILED;
+    }
+
+    // Jittered exponential backoff before the next attempt
+    std::chrono::duration<double> backoff() const { return retry_backoff(policy, attempt + 1); }
+
+    // Runs attempts on this thread until the node is answered or given up on
+    void fetch(const std::string& node, FetchStats& stats, std::vector<std::string>& neighbors) {
+        for (attempt = 0;; attempt++) {
+            prepare(node, neighbors);
+            Outcome outcome = finish(curl_easy_perform(curl), node, stats);
+            if (outcome != RETRY)
+                return;
+            std::this_thread::sleep_for(backoff());
+        }
+    }
+
+private:
+    ConnectionPool& pool;
+    const FetchOptions& options;
+    const RetryPolicy& policy;
+    CURL* curl;
+    std::vector<std::string>* neighbors = nullptr;         // list of the node being fetched
+    std::function<void(const char*, size_t)> collect;       // appends a name to it
+};
+
+class NeighborFetcher {
+public:
+    explicit NeighborFetcher(const FetchOptions& options) : options(options), pool(options.service_url) {
+        policy.max_attempts = options.retries + 1;
+        policy.deadline_ms = options.timeout_ms;
+        // Bad JSON aborts the transfer with a write error, so it counts as transient too: it may
+        // have been cut short on the way, and another attempt may get all of it
+        policy.retry_malformed = true;
+    }
+    virtual ~NeighborFetcher() {}
+
+    NeighborFetcher(const NeighborFetcher&) = delete;
+    NeighborFetcher& operator=(const NeighborFetcher&) = delete;
+
+    // Neighbor lists of nodes, in the same order; a node given up on gets an empty list
+    virtual void fetch(const std::vector<std::string>& nodes, std::vector<std::vector<std::string>>& lists) = 0;
+
+    // Nodes the fetcher works on at once, the batch size that keeps it busy
+    virtual int parallelism() const = 0;
+
+    // Adds the fetcher's statistics so far to total
+    virtual void add_stats(FetchStats& total) const = 0;
+
+protected:
+    FetchOptions options;
+    RetryPolicy policy;
+    ConnectionPool pool;            // outlives the handles of the derived fetchers
+};
+
+// One handle, one request at a time: the sequential clients
+class BlockingFetcher : public NeighborFetcher {
+public:
+    explicit BlockingFetcher(const FetchOptions& options) : NeighborFetcher(options), handle(pool, this->options, policy) {}
+
+    void fetch(const std::vector<std::string>& nodes, std::vector<std::vector<std::string>>& lists) override {
+        lists.resize(nodes.size());
+        for (size_t i = 0; i < nodes.size(); i++)
+            handle.fetch(nodes[i], stats, lists[i]);
+    }
+    int parallelism() const override { return 1; }
+    void add_stats(FetchStats& total) const override { total.merge(stats); }
+
+private:
+    FetchHandle handle;
+    FetchStats stats;
+};
+
+// One blocking request per thread, the threads taking the batch's nodes one at a time. Each
+// thread keeps its handle, so its connection, and its statistics from one batch to the next.
+class ThreadPoolFetcher : public NeighborFetcher {
+public:
+    explicit ThreadPoolFetcher(const FetchOptions& options) : NeighborFetcher(options) {
+        for (int t = 0; t < this->options.parallelism; t++) {
+            handles.emplace_back(new FetchHandle(pool, this->options, policy));
+            stats.emplace_back(new FetchStats);
+        }
+    }
+
+    void fetch(const std::vector<std::string>& nodes, std::vector<std::vector<std::string>>& lists) override {
+        lists.resize(nodes.size());
+        const long n = nodes.size();
+        if (n == 0)
+            return;
+        const int threads = (int)std::min<long>(options.parallelism, n);
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+        for (long i = 0; i < n; i++) {
+            const int t = omp_get_thread_num();
+            handles[t]->fetch(nodes[i], *stats[t], lists[i]);
+        }
+    }
+    int parallelism() const override { return options.parallelism; }
+    void add_stats(FetchStats& total) const override {
+        for (const auto& s : stats)
+            total.merge(*s);
+    }
+
+private:
+    std::vector<std::unique_ptr<FetchHandle>> handles;
+    std::vector<std::unique_ptr<FetchStats>> stats;
+};
+
+// Up to parallelism transfers on one curl_multi handle, driven from the calling thread. A retry
+// waits out its backoff without holding a slot.
+class MultiFetcher : public NeighborFetcher {
+public:
+    explicit MultiFetcher(const FetchOptions& options) : NeighborFetcher(options) {
+        multi = curl_multi_init();
+        curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)this->options.parallelism);
+        // Keep every handle's connection open, also while a small batch leaves most of them idle
+        curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, (long)this->options.parallelism);
+        for (int i = 0; i < this->options.parallelism; i++) {
+            handles.emplace_back(new FetchHandle(pool, this->options, policy));
+            idle.push_back(handles.back().get());
+            by_curl[handles.back()->get()] = handles.back().get();
+        }
+    }
+    ~MultiFetcher() override { curl_multi_cleanup(multi); }
+
+    void fetch(const std::vector<std::string>& nodes, std::vector<std::vector<std::string>>& lists) override {
+        typedef std::chrono::steady_clock Clock;
+        struct Waiting {
+            size_t index;
+            int attempt;
+            Clock::time_point ready;
+        };
+
+        lists.resize(nodes.size());
+        std::deque<Waiting> queue;          // in the order attempts may start
+        for (size_t i = 0; i < nodes.size(); i++)
+            queue.push_back({i, 0, Clock::time_point()});
+        std::vector<Waiting> backing_off;
+        size_t finished = 0;
+
+        while (finished < nodes.size()) {
+            const Clock::time_point now = Clock::now();
+            for (size_t i = 0; i < backing_off.size();) {
+                if (backing_off[i].ready <= now) {
+                    queue.push_back(backing_off[i]);
+                    backing_off[i] = backing_off.back();
+                    backing_off.pop_back();
+                } else {
+                    i++;
+                }
+            }
+            while (!queue.empty() && !idle.empty()) {
+                FetchHandle* handle = idle.back();
+                idle.pop_back();
+                handle->index = queue.front().index;
+                handle->attempt = queue.front().attempt;
+                queue.pop_front();
+                handle->prepare(nodes[handle->index], lists[handle->index]);
+                curl_multi_add_handle(multi, handle->get());
+            }
+
+            int running = 0;
+            curl_multi_perform(multi, &running);
+            int left = 0;
+            while (CURLMsg* msg = curl_multi_info_read(multi, &left)) {
+                if (msg->msg != CURLMSG_DONE)
+                    continue;
+                FetchHandle& handle = *by_curl[msg->easy_handle];
+                const CURLcode result = msg->data.result;
+                curl_multi_remove_handle(multi, handle.get());
+                FetchHandle::Outcome outcome = handle.finish(result, nodes[handle.index], stats);
+                if (outcome == FetchHandle::RETRY)
+                    backing_off.push_back({handle.index, handle.attempt + 1, Clock::now() + std::chrono::duration_cast<Clock::duration>(handle.backoff())});
+                else
+                    finished++;
+                idle.push_back(&handle);
+            }
+            if (finished == nodes.size() || (!queue.empty() && !idle.empty()))
+                continue;
+
+            // Sleep until a transfer has news or the first backoff is over
+            long wait_ms = 1000;
+            for (const Waiting& w : backing_off)
+                wait_ms = std::min<long>(wait_ms, std::chrono::duration_cast<std::chrono::milliseconds>(w.ready - Clock::now()).count() + 1);
+            curl_multi_poll(multi, nullptr, 0, (int)std::max(0L, wait_ms), nullptr);
+        }
+    }
+    int parallelism() const override { return options.parallelism; }
+    void add_stats(FetchStats& total) const override { total.merge(stats); }
+
+private:
+    CURLM* multi;
+    std::vector<std::unique_ptr<FetchHandle>> handles;
+    std::vector<FetchHandle*> idle;
+    std::unordered_map<CURL*, FetchHandle*> by_curl;       // the pool owns CURLOPT_PRIVATE
+    FetchStats stats;
+};
+
+// FIFO BFS, the algorithm of the sequential clients. The queue is served parallelism() nodes at
+// a time and their answers are merged in queue order, which is exactly what taking one node at
+// a time would have done, so a batch may end one level and start the next. A negative depth
+// crawls nothing, like 0.
+inline std::vector<std::vector<std::string>> queue_bfs(NeighborFetcher& fetcher, const std::string& start, int depth) {
+    depth = std::max(depth, 0);
+    std::vector<std::vector<std::string>> levels(depth + 1);
+    std::unordered_set<std::string> visited{start};
+    std::deque<std::pair<int, std::string>> queue;  // (level, node), only nodes above depth
+    levels[0].push_back(start);
+    if (depth > 0)
+        queue.emplace_back(0, start);
+
+    std::vector<std::pair<int, std::string>> batch;
+    std::vector<std::string> nodes;
+    std::vector<std::vector<std::string>> lists;
+    while (!queue.empty()) {
+        batch.clear();
+        nodes.clear();
+        while (!queue.empty() && (int)batch.size() < fetcher.parallelism()) {
+            batch.push_back(std::move(queue.front()));
+            nodes.push_back(batch.back().second);
+            queue.pop_front();
+        }
+        fetcher.fetch(nodes, lists);
+        for (size_t i = 0; i < batch.size(); i++) {
+            const int next = batch[i].first + 1;
+            for (std::string& neighbor : lists[i]) {
+                if (!visited.insert(neighbor).second)
+                    continue;
+                if (next < depth)
+                    queue.emplace_back(next, neighbor);
+                levels[next].push_back(std::move(neighbor));
+            }
+        }
+    }
+    return levels;
+}
+
+// Level-synchronous BFS: each level is one batch, merged in order before the next one starts.
+// A negative depth crawls nothing, like 0.
+inline std::vector<std::vector<std::string>> level_bfs(NeighborFetcher& fetcher, const std::string& start, int depth) {
+    depth = std::max(depth, 0);
+    std::vector<std::vector<std::string>> levels(depth + 1);
+    std::unordered_set<std::string> visited{start};
+    levels[0].push_back(start);
+
+    std::vector<std::vector<std::string>> lists;
+    for (int d = 0; d < depth; d++) {
+        fetcher.fetch(levels[d], lists);
+        for (std::vector<std::string>& neighbors : lists)
+            for (std::string& neighbor : neighbors)
+                if (visited.insert(neighbor).second)
+                    levels[d + 1].push_back(std::move(neighbor));
+    }
+    return levels;
+}
+
+// Bidirectional BFS for a shortest path of at most max_depth hops. Each round expands one level
+// of the side with the smaller frontier as one batch; the search stops at the first round where
+// the sides meet. Returns an empty path if there is none.
+inline std::vector<std::string> bidirectional_path(NeighborFetcher& fetcher, const std::string& source,
+                                                   const std::string& target, int max_depth) {
+    if (source == target)
+        return {source};
+
+    std::unordered_map<std::string, std::string> parent[2];    // node -> the node it was reached from
+    std::vector<std::string> frontier[2] = {{source}, {target}};
+    parent[0][source] = "";
+    parent[1][target] = "";
+    int depth[2] = {0, 0};
+
+    std::vector<std::vector<std::string>> lists;
+    while (depth[0] + depth[1] < max_depth && !frontier[0].empty() && !frontier[1].empty()) {
+        const int side = frontier[0].size() <= frontier[1].size() ? 0 : 1;
+        fetcher.fetch(frontier[side], lists);
+        depth[side]++;
+
+        std::vector<std::string> next;
+        const std::string* meeting = nullptr;
+        for (size_t i = 0; i < lists.size() && !meeting; i++) {
+            for (const std::string& neighbor : lists[i]) {
+                auto inserted = parent[side].emplace(neighbor, frontier[side][i]);
+                if (!inserted.second)
+                    continue;
+                if (parent[1 - side].count(neighbor)) {
+                    meeting = &inserted.first->first;
+                    break;
+                }
+                next.push_back(neighbor);
+            }
+        }
+        if (meeting) {
+            std::vector<std::string> path;
+            for (std::string node = *meeting; !node.empty(); node = parent[0][node])
+                path.insert(path.begin(), node);
+            for (std::string node = parent[1][*meeting]; !node.empty(); node = parent[1][node])
+                path.push_back(node);
+            return path;
+        }
+        frontier[side] = std::move(next);
+    }
+    return {};
+}
+
+#endif
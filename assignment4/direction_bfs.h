@@ -0,0 +1,231 @@
+#ifndef DIRECTION_BFS_H
+#define DIRECTION_BFS_H
+
+// Direction-optimizing BFS (Beamer, Asanovic and Patterson) over a crawl snapshot. Small
+// frontiers are expanded top-down from a queue, as a crawl would. Once the frontier's edges
+// outnumber a fraction of the edges still unexplored, which on the hub-heavy actor/movie graph
+// happens after a level or two, every unvisited node instead looks for a parent in a frontier
+// bitmap and stops at the first one it finds, skipping most of the edges a top-down step
+// would have to check.
+//
+// Both steps are parallel with OpenMP and the result is the same level structure a crawl
+// produces. Built without -fopenmp it runs sequentially.
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "crawl_snapshot.h"
+
+struct DirectionBfsStats {
+    std::string steps;              // 'T' (top-down) or 'B' (bottom-up) for every expanded level
+    uint64_t edges_examined = 0;
+    double seconds = 0;
+};
+
+class DirectionOptimizingBFS {
+public:
+    explicit DirectionOptimizingBFS(const CrawlSnapshot& graph) : g(graph), n(graph.num_nodes()) {}
+
+    // Fills levels with the node ids at each distance 0..depth from root. Returns false if the
+    // snapshot lacks the neighbor list of a node that has to be expanded.
+    bool run(uint32_t root, int depth, std::vector<std::vector<uint32_t>>& levels, DirectionBfsStats* stats = nullptr) {
+        const auto started = std::chrono::steady_clock::now();
+        DirectionBfsStats local_stats;
+        DirectionBfsStats& st = stats ? *stats : local_stats;
+        st = DirectionBfsStats();
+
+        level_of.assign(n, -1);
+        level_of[root] = 0;
+        queue.assign(1, root);
+        frontier_size = 1;
+        frontier_edges = degree(root);
+        frontier_missing = g.expanded(root) ? 0 : 1;
+        unexplored_edges = g.num_edges() - frontier_edges;
+
+        levels.assign(depth + 1, std::vector<uint32_t>());
+        levels[0].push_back(root);
+        bool bottom_up = false;
+        bool any_bottom_up = false;
+        bool complete = true;
+        uint64_t previous_size = 0;
+        for (int level = 0; level < depth && frontier_size > 0; level++) {
+            if (frontier_missing > 0) {
+                complete = false;
+                break;
+            }
+
+            // The paper's ALPHA pays off over the levels that follow; the last level of a
+            // depth-limited search has none, so there bottom-up must beat top-down outright
+            bool growing = frontier_size > previous_size;
+            previous_size = frontier_size;
+            uint64_t threshold = level + 1 == depth ? unexplored_edges : unexplored_edges / ALPHA;
+            if (!bottom_up && growing && frontier_edges > threshold) {
+                bottom_up = true;
+                queue_to_bitmap();
+            } else if (bottom_up && frontier_size < n / BETA) {
+                bottom_up = false;
+                bitmap_to_queue();
+            }
+
+            if (bottom_up) {
+                st.edges_examined += bottom_up_step(level);
+                any_bottom_up = true;
+            } else {
+                st.edges_examined += top_down_step(level);
+                levels[level + 1] = queue;
+            }
+            st.steps += bottom_up ? 'B' : 'T';
+            unexplored_edges -= std::min(unexplored_edges, frontier_edges);
+        }
+
+        // Levels found bottom-up only exist as marks in level_of
+        if (any_bottom_up) {
+            for (uint64_t v = 0; v < n; v++) {
+                int32_t level = level_of[v];
+                if (level > 0 && level <= depth && st.steps[level - 1] == 'B')
+                    levels[level].push_back(v);
+            }
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+        st.seconds = elapsed.count();
+        return complete;
+    }
+
+private:
+    // Switching thresholds from the paper: go bottom-up once a growing frontier has more than
+    // 1/ALPHA of the unexplored edges, back to top-down once it holds fewer than 1/BETA of the nodes
+    static const uint64_t ALPHA = 14;
+    static const uint64_t BETA = 24;
+
+    uint64_t degree(uint32_t v) const { return g.neighbors_end(v) - g.neighbors_begin(v); }
+
+    static bool test(const std::vector<uint64_t>& bits, uint32_t v) { return (bits[v >> 6] >> (v & 63)) & 1; }
+
+    // Expands the queue; nodes are claimed with a CAS so each one lands in exactly one next queue
+    uint64_t top_down_step(int level) {
+        std::vector<uint32_t> next_queue;
+        uint64_t size = 0, edges = 0, missing = 0, examined = 0;
+        const int64_t count = queue.size();
+
+        #pragma omp parallel reduction(+:size, edges, missing, examined)
+        {
+            std::vector<uint32_t> found;
+            #pragma omp for schedule(dynamic, 64) nowait
+            for (int64_t i = 0; i < count; i++) {
+                uint32_t u = queue[i];
+                for (const uint32_t* v = g.neighbors_begin(u); v != g.neighbors_end(u); ++v) {
+                    examined++;
+                    int32_t unvisited = -1;
+                    if (__atomic_load_n(&level_of[*v], __ATOMIC_RELAXED) < 0
+                        && __atomic_compare_exchange_n(&level_of[*v], &unvisited, level + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                        found.push_back(*v);
+                        size++;
+                        edges += degree(*v);
+                        missing += g.expanded(*v) ? 0 : 1;
+                    }
+                }
+            }
+            #pragma omp critical
+            next_queue.insert(next_queue.end(), found.begin(), found.end());
+        }
+
+        queue.swap(next_queue);
+        frontier_size = size;
+        frontier_edges = edges;
+        frontier_missing = missing;
+        return examined;
+    }
+
+    // Every unvisited node scans its own list for a parent in the frontier. A thread owns whole
+    // bitmap words, so the next frontier is written without atomics.
+    uint64_t bottom_up_step(int level) {
+        const int64_t words = front.size();
+        uint64_t size = 0, edges = 0, missing = 0, examined = 0;
+
+        #pragma omp parallel for schedule(dynamic, 256) reduction(+:size, edges, missing, examined)
+        for (int64_t w = 0; w < words; w++) {
+            uint64_t bits = 0;
+            const uint64_t end = std::min<uint64_t>(n, (w + 1) * 64);
+            for (uint64_t v = w * 64; v < end; v++) {
+                if (level_of[v] >= 0)
+                    continue;
+                for (const uint32_t* u = g.neighbors_begin(v); u != g.neighbors_end(v); ++u) {
+                    examined++;
+                    if (test(front, *u)) {
+                        level_of[v] = level + 1;
+                        bits |= uint64_t(1) << (v & 63);
+                        size++;
+                        edges += degree(v);
+                        missing += g.expanded(v) ? 0 : 1;
+                        break;
+                    }
+                }
+            }
+            next[w] = bits;
+        }
+
+        front.swap(next);
+        frontier_size = size;
+        frontier_edges = edges;
+        frontier_missing = missing;
+        return examined;
+    }
+
+    void queue_to_bitmap() {
+        const uint64_t words = (n + 63) / 64;
+        front.assign(words, 0);
+        next.assign(words, 0);
+        for (uint32_t v : queue)
+            front[v >> 6] |= uint64_t(1) << (v & 63);
+    }
+
+    // The bitmap of the last bottom-up step holds exactly the nodes at the current level
+    void bitmap_to_queue() {
+        queue.clear();
+        for (uint64_t w = 0; w < front.size(); w++)
+            for (uint64_t bits = front[w]; bits; bits &= bits - 1)
+                queue.push_back(w * 64 + __builtin_ctzll(bits));
+    }
+
+    const CrawlSnapshot& g;
+    const uint64_t n;
+    std::vector<int32_t> level_of;
+    std::vector<uint32_t> queue;            // frontier while top-down
+    std::vector<uint64_t> front, next;      // frontier bitmaps while bottom-up
+    uint64_t frontier_size = 0;
+    uint64_t frontier_edges = 0;            // sum of the frontier's degrees
+    uint64_t frontier_missing = 0;          // frontier nodes without a complete neighbor list
+    uint64_t unexplored_edges = 0;
+};
+
+// Level-by-level BFS from start entirely within the snapshot. Returns false if the answer would
+// need a node the snapshot has not expanded, or does not know start at all.
+inline bool snapshot_bfs(const CrawlSnapshot& snapshot, const std::string& start, int depth,
+                         std::vector<std::vector<std::string>>& levels, DirectionBfsStats* stats = nullptr) {
+    levels.clear();
+    int64_t root = snapshot.find(start);
+    if (root < 0)
+        return false;
+
+    std::vector<std::vector<uint32_t>> ids;
+    DirectionOptimizingBFS bfs(snapshot);
+    if (!bfs.run(root, depth, ids, stats))
+        return false;
+
+    levels.resize(ids.size());
+    for (size_t level = 0; level < ids.size(); level++) {
+        levels[level].reserve(ids[level].size());
+        for (uint32_t v : ids[level])
+            levels[level].push_back(snapshot.name(v));
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef GRAPH_ANALYTICS_H
+#define GRAPH_ANALYTICS_H
+
+// Whole-graph analytics over a crawl snapshot (crawl_snapshot.h): degree distribution,
+// connected components, PageRank and sampled betweenness. Everything works on the snapshot's
+// CSR arrays in place and is parallel with OpenMP; built without -fopenmp it runs sequentially.
+//
+// The snapshot is read as an undirected graph. The lists of nodes at the edge of the crawl only
+// hold the expanded nodes that named them, so results describe the crawled subgraph, not the
+// whole service graph.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "crawl_snapshot.h"
+
+struct PageRankStats {
+    int iterations = 0;
+    double residual = 0;            // L1 change of the last iteration
+};
+
+class GraphAnalytics {
+public:
+    explicit GraphAnalytics(const CrawlSnapshot& graph) : g(graph), n(graph.num_nodes()) {}
+
+    uint64_t degree(uint32_t v) const { return g.neighbors_end(v) - g.neighbors_begin(v); }
+
+    // counts[d] is the number of nodes with degree d
+    std::vector<uint64_t> degree_histogram() const {
+        uint64_t max_degree = 0;
+        #pragma omp parallel for reduction(max:max_degree)
+        for (int64_t v = 0; v < (int64_t)n; v++)
+            max_degree = std::max(max_degree, degree(v));
+
+        std::vector<uint64_t> counts(max_degree + 1, 0);
+        #pragma omp parallel
+        {
+            std::vector<uint64_t> local(max_degree + 1, 0);
+            #pragma omp for nowait
+            for (int64_t v = 0; v < (int64_t)n; v++)
+                local[degree(v)]++;
+            #pragma omp critical
+            for (uint64_t d = 0; d <= max_degree; d++)
+                counts[d] += local[d];
+        }
+        return counts;
+    }
+
+    // Component of every node, named by its smallest node id. Lock-free union-find: every edge
+    // links the larger of its two roots below the smaller one with a CAS, and finds halve the
+    // paths they walk. Roots only ever move to smaller ids, so concurrent unions cannot form a
+    // cycle, and the root a component ends up with is its smallest id.
+    std::vector<uint32_t> connected_components() const {
+        std::vector<uint32_t> parent(n);
+        #pragma omp parallel for
+        for (int64_t v = 0; v < (int64_t)n; v++)
+            parent[v] = v;
+
+        #pragma omp parallel for schedule(dynamic, 256)
+        for (int64_t u = 0; u < (int64_t)n; u++)
+            for (const uint32_t* v = g.neighbors_begin(u); v != g.neighbors_end(u); ++v)
+                if (*v < u)
+                    unite(parent, u, *v);
+
+        #pragma omp parallel for
+        for (int64_t v = 0; v < (int64_t)n; v++)
+            parent[v] = find(parent, v);
+        return parent;
+    }
+
+    // PageRank by power iteration, pulling over the CSR lists: a node's new rank is a gather-sum
+    // of its neighbors' rank/degree, an SpMV with the adjacency that needs no atomics and no
+    // transposed copy. The gathered rank/degree values are floats, which halves the bytes of the
+    // random reads that dominate the loop; sums stay in double. Dangling nodes spread their rank
+    // evenly. Stops after max_iterations or once the L1 change drops below tolerance.
+    std::vector<double> pagerank(double damping, int max_iterations, double tolerance, PageRankStats* stats = nullptr) const {
+        std::vector<double> rank(n, n ? 1.0 / n : 0.0), next(n);
+        std::vector<float> contribution(n);
+        PageRankStats st;
+        for (st.iterations = 0; st.iterations < max_iterations; st.iterations++) {
+            double dangling = 0;
+            #pragma omp parallel for reduction(+:dangling)
+            for (int64_t u = 0; u < (int64_t)n; u++) {
+                const uint64_t d = degree(u);
+                contribution[u] = d ? rank[u] / d : 0.0;
+                dangling += d ? 0.0 : rank[u];
+            }
+
+            const double base = (1.0 - damping + damping * dangling) / n;
+            const float* c = contribution.data();
+            double residual = 0;
+            #pragma omp parallel for schedule(dynamic, 256) reduction(+:residual)
+            for (int64_t v = 0; v < (int64_t)n; v++) {
+                const uint32_t* list = g.neighbors_begin(v);
+                const int64_t d = degree(v);
+                double sum = 0;
+                #pragma omp simd reduction(+:sum)
+                for (int64_t i = 0; i < d; i++)
+                    sum += c[list[i]];
+                next[v] = base + damping * sum;
+                residual += std::abs(next[v] - rank[v]);
+            }
+            rank.swap(next);
+            st.residual = residual;
+            if (residual < tolerance) {
+                st.iterations++;
+                break;
+            }
+        }
+        if (stats)
+            *stats = st;
+        return rank;
+    }
+
+    // Betweenness centrality estimated from Brandes' algorithm run from samples random sources
+    // (all of them if samples >= n), scaled up to the full source set and halved for the
+    // undirected graph. The sources run in parallel; each thread keeps its own BFS state and
+    // resets only the nodes a source reached.
+    std::vector<double> approximate_betweenness(uint64_t samples, uint64_t seed) const {
+        std::vector<uint32_t> sources;
+        if (samples >= n) {
+            for (uint64_t v = 0; v < n; v++)
+                sources.push_back(v);
+        } else {
+            std::mt19937_64 rng(seed);
+            std::uniform_int_distribution<uint64_t> pick(0, n - 1);
+            std::unordered_set<uint32_t> chosen;
+            while (chosen.size() < samples)
+                chosen.insert(pick(rng));
+            sources.assign(chosen.begin(), chosen.end());
+            std::sort(sources.begin(), sources.end());
+        }
+
+        std::vector<double> centrality(n, 0.0);
+        const int64_t count = sources.size();
+        #pragma omp parallel
+        {
+            std::vector<int32_t> dist(n, -1);
+            std::vector<double> sigma(n, 0.0), delta(n, 0.0);
+            std::vector<uint32_t> order;        // nodes in BFS order
+            order.reserve(1024);
+
+            #pragma omp for schedule(dynamic, 1)
+            for (int64_t i = 0; i < count; i++) {
+                const uint32_t s = sources[i];
+                order.clear();
+                order.push_back(s);
+                dist[s] = 0;
+                sigma[s] = 1;
+                for (size_t head = 0; head < order.size(); head++) {
+                    const uint32_t u = order[head];
+                    for (const uint32_t* v = g.neighbors_begin(u); v != g.neighbors_end(u); ++v) {
+                        if (dist[*v] < 0) {
+                            dist[*v] = dist[u] + 1;
+                            order.push_back(*v);
+                        }
+                        if (dist[*v] == dist[u] + 1)
+                            sigma[*v] += sigma[u];
+                    }
+                }
+
+                // Dependencies in reverse BFS order: a node passes its share on to its parents
+                for (size_t k = order.size(); k-- > 1;) {
+                    const uint32_t w = order[k];
+                    const double share = (1.0 + delta[w]) / sigma[w];
+                    for (const uint32_t* v = g.neighbors_begin(w); v != g.neighbors_end(w); ++v)
+                        if (dist[*v] == dist[w] - 1)
+                            delta[*v] += sigma[*v] * share;
+                    if (delta[w] != 0) {
+                        #pragma omp atomic
+                        centrality[w] += delta[w];
+                    }
+                }
+
+                for (uint32_t v : order) {
+                    dist[v] = -1;
+                    sigma[v] = 0;
+                    delta[v] = 0;
+                }
+            }
+        }
+
+        const double scale = count ? (double)n / count / 2.0 : 0.0;
+        #pragma omp parallel for
+        for (int64_t v = 0; v < (int64_t)n; v++)
+            centrality[v] *= scale;
+        return centrality;
+    }
+
+private:
+    static uint32_t find(std::vector<uint32_t>& parent, uint32_t v) {
+        for (;;) {
+            uint32_t p = __atomic_load_n(&parent[v], __ATOMIC_RELAXED);
+            if (p == v)
+                return v;
+            uint32_t grandparent = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+            if (grandparent != p)   // path halving; losing this race only skips a shortcut
+                __atomic_compare_exchange_n(&parent[v], &p, grandparent, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+            v = grandparent;
+        }
+    }
+
+    static void unite(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+        for (;;) {
+            a = find(parent, a);
+            b = find(parent, b);
+            if (a == b)
+                return;
+            if (a < b)
+                std::swap(a, b);
+            uint32_t expected = a;      // a is still a root unless someone linked it meanwhile
+            if (__atomic_compare_exchange_n(&parent[a], &expected, b, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return;
+        }
+    }
+
+    const CrawlSnapshot& g;
+    const uint64_t n;
+};
+
+#endif
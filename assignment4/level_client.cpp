@@ -1,138 +1,21 @@
+// The sequential level-by-level client: one request at a time on one handle, each level merged
+// in order before the next one starts. The crawling itself is crawler.h's BlockingFetcher with
+// the level_bfs strategy, the same code the crawl benchmark runs.
+
 #include <iostream>
 #include <string>
-#include <queue>
-#include <unordered_set>
-#include <cstdio>
+#include <vector>
+#include <chrono>
 #include <cstdlib>
 #include <curl/curl.h>
-#include <stdexcept>
-#include "rapidjson/error/error.h"
-#include "rapidjson/reader.h"
-
-
-struct ParseException : std::runtime_error, rapidjson::ParseResult {
-    ParseException(rapidjson::ParseErrorCode code, const char* msg, size_t offset) : 
-        std::runtime_error(msg), 
-        rapidjson::ParseResult(code, offset) {}
-};
-
-#define RAPIDJSON_PARSE_ERROR_NORETURN(code, offset) \
-    throw ParseException(code, #code, offset)
-
-#include <rapidjson/document.h>
-#include <chrono>
+#include "crawler.h"
 
 using namespace std;
-using namespace rapidjson;
-
-bool debug = false;
-
-// Updated service URL
-const string SERVICE_URL = "http://hollywood-graph-crawler.bridgesuncc.org/neighbors/";
-
-// Function to HTTP ecnode parts of URLs. for instance, replace spaces with '%20' for URLs
-string url_encode(CURL* curl, string input) {
-  char* out = curl_easy_escape(curl, input.c_str(), input.size());
-  string s = out;
-  curl_free(out);
-  return s;
-}
-
-// Callback function for writing response data
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, string* output) {
-    size_t totalSize = size * nmemb;
-    output->append((char*)contents, totalSize);
-    return totalSize;
-}
-
-// Function to fetch neighbors using libcurl with debugging
-string fetch_neighbors(CURL* curl, const string& node) {
-
-    string url = SERVICE_URL + url_encode(curl, node);
-    string response;
-
-    if (debug)
-      cout << "Sending request to: " << url << endl;
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-    // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L); // Verbose Logging
-
-    // Set a User-Agent header to avoid potential blocking by the server
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "User-Agent: C++-Client/1.0");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-    CURLcode res = curl_easy_perform(curl);
-
-    if (res != CURLE_OK) {
-        cerr << "CURL error: " << curl_easy_strerror(res) << endl;
-    } else {
-      if (debug)
-        cout << "CURL request successful!" << endl;
-    }
-
-    // Cleanup
-    curl_slist_free_all(headers);
-
-    if (debug) 
-      cout << "Response received: " << response << endl;  // Debug log
-
-    return (res == CURLE_OK) ? response : "{}";
-}
-
-// Function to parse JSON and extract neighbors
-vector<string> get_neighbors(const string& json_str) {
-    vector<string> neighbors;
-    try {
-      Document doc;
-      doc.Parse(json_str.c_str());
-      
-      if (doc.HasMember("neighbors") && doc["neighbors"].IsArray()) {
-        for (const auto& neighbor : doc["neighbors"].GetArray())
-	  neighbors.push_back(neighbor.GetString());
-      }
-    } catch (const ParseException& e) {
-      std::cerr<<"Error while parsing JSON: "<<json_str<<std::endl;
-      throw e;
-    }
-    return neighbors;
-}
-
-// BFS Traversal Function
-vector<vector<string>> bfs(CURL* curl, const string& start, int depth) {
-  vector<vector<string>> levels;
-  unordered_set<string> visited;
-  
-  levels.push_back({start});
-  visited.insert(start);
-
-  for (int d = 0;  d < depth; d++) {
-    if (debug)
-      std::cout<<"starting level: "<<d<<"\n";
-    levels.push_back({});
-    for (string& s : levels[d]) {
-      try {
-	if (debug)
-	  std::cout<<"Trying to expand"<<s<<"\n";
-	for (const auto& neighbor : get_neighbors(fetch_neighbors(curl, s))) {
-	  if (debug)
-	    std::cout<<"neighbor "<<neighbor<<"\n";
-	  if (!visited.count(neighbor)) {
-	    visited.insert(neighbor);
-	    levels[d+1].push_back(neighbor);
-	  }
-	}
-      } catch (const ParseException& e) {
-	std::cerr<<"Error while fetching neighbors of: "<<s<<std::endl;
-	throw e;
-      }
-    }
-  }
-  
-  return levels;
+// Updated service URL; HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+string service_url() {
+    const char* root = getenv("HOLLYWOOD_SERVICE_URL");
+    return string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
 }
 
 int main(int argc, char* argv[]) {
@@ -149,29 +32,28 @@ int main(int argc, char* argv[]) {
         cerr << "Error: Depth must be an integer.\n";
         return 1;
     }
-
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        cerr << "Failed to initialize CURL" << endl;
-        return -1;
+    if (depth < 0) {
+        cerr << "Error: Depth must be a non-negative integer.\n";
+        return 1;
     }
 
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    FetchOptions options;
+    options.service_url = service_url();
+    BlockingFetcher fetcher(options);
 
     const auto start{std::chrono::steady_clock::now()};
-    
-    
-    for (const auto& n : bfs(curl, start_node, depth)) {
-      for (const auto& node : n)
-	cout << "- " << node << "\n";
-      std::cout<<n.size()<<"\n";
+
+    for (const auto& n : level_bfs(fetcher, start_node, depth)) {
+        for (const auto& node : n)
+            cout << "- " << node << "\n";
+        std::cout << n.size() << "\n";
     }
-    
+
     const auto finish{std::chrono::steady_clock::now()};
     const std::chrono::duration<double> elapsed_seconds{finish - start};
-    std::cout << "Time to crawl: "<<elapsed_seconds.count() << "s\n";
-    
-    curl_easy_cleanup(curl);
+    std::cout << "Time to crawl: " << elapsed_seconds.count() << "s\n";
 
-    
+    curl_global_cleanup();
     return 0;
-}
\ No newline at end of file
+}
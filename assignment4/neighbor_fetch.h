@@ -0,0 +1,138 @@
+#ifndef NEIGHBOR_FETCH_H
+#define NEIGHBOR_FETCH_H
+
+// One request for a node's neighbor list, the way every crawler in the tree makes it. A request
+// runs on a ConnectionPool handle: prepare_request() points the handle at the node and its
+// parser at a callback, the caller runs the transfer however it schedules transfers (blocking
+// on its own thread, on a curl_multi handle, from a coroutine), and finish_request() completes
+// the parse and says how it went. A node worth another attempt waits retry_backoff() first.
+// fetch_neighbors_blocking() is the whole loop for a thread that runs one request at a time.
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <thread>
+
+#include <curl/curl.h>
+
+#include "concurrency_controller.h"
+#include "connection_pool.h"
+#include "neighbor_stream.h"
+
+// Retry, deadline and hedging settings for every request
+struct RetryPolicy {
+    int max_attempts = 4;
+    long deadline_ms = 30000;               // per attempt, a slower request counts as a timeout
+    double backoff_base = 0.1;              // seconds, doubled for every retry
+    double backoff_cap = 5.0;
+    bool hedge = false;                     // duplicate requests slower than the observed p95
+    bool retry_malformed = false;           // bad JSON may be a response cut short on the way
+};
+
+// How a finished request went
+struct RequestResult {
+    bool ok = false;            // answered, every name delivered
+    bool malformed = false;     // the response was not a neighbor list
+    bool retryable = false;     // a failure that may not repeat: timeout, connection error, 429, 5xx
+    CURLcode code = CURLE_OK;
+    long status = 0;
+    ConcurrencyController::Outcome outcome = ConcurrencyController::SUCCESS;
+};
+
+// Function to HTTP ecnode parts of URLs. for instance, replace spaces with '%20' for URLs.
+// Appends to out, so a reused buffer needs no allocation; escapes what curl_easy_escape() does.
+inline void append_url_encoded(std::string& out, const std::string& input) {
+    static const char HEX[] = "0123456789ABCDEF";
+    for (unsigned char c : input) {
+        if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-' || c == '.' || c == '_' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += HEX[c >> 4];
+            out += HEX[c & 15];
+        }
+    }
+}
+
+// Points a pool handle at the neighbor list of node under service_url. The names will go to
+// on_neighbor as they are parsed out of the response, so it must outlive the transfer.
+inline void prepare_request(CURL* curl, const std::string& service_url, const std::string& node,
+                            const std::function<void(const char*, size_t)>& on_neighbor, long timeout_ms) {
+    FetchBuffers& buffers = FetchBuffers::of(curl);
+    buffers.url.assign(service_url);
+    append_url_encoded(buffers.url, node);
+    buffers.stream.reset(on_neighbor);
+    curl_easy_setopt(curl, CURLOPT_URL, buffers.url.c_str());
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buffers.stream);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
+}
+
+// Completes the parse of a transfer that curl has finished with result
+inline RequestResult finish_request(CURL* curl, CURLcode result) {
+    RequestResult r;
+    r.code = result;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &r.status);
+    // Timeouts, 429s and 5xx mean the server is overloaded, anything else failing does not
+    if (result == CURLE_OPERATION_TIMEDOUT || r.status == 429 || r.status >= 500)
+        r.outcome = ConcurrencyController::CONGESTION;
+    else if (result != CURLE_OK)
+        r.outcome = ConcurrencyController::FAILURE;
+
+    NeighborStream& stream = FetchBuffers::of(curl).stream;
+    if (result == CURLE_OK && stream.finish()) {
+        r.ok = true;
+    } else if (stream.failed()) {
+        r.malformed = true;
+    } else {
+        // 4xx other than 429 will not get better by asking again
+        r.retryable = !(r.status >= 400 && r.status < 500 && r.status != 429);
+    }
+    return r;
+}
+
+// Whether a failed attempt is worth another one under policy, attempts permitting
+inline bool worth_retrying(const RetryPolicy& policy, const RequestResult& r) {
+    return r.retryable || (r.malformed && policy.retry_malformed);
+}
+
+// Function to pick the wait before retry number `attempt`: exponential backoff with full jitter,
+// so that workers that failed together do not all come back at the same moment
+inline std::chrono::duration<double> retry_backoff(const RetryPolicy& policy, int attempt) {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    double ceiling = std::min(policy.backoff_cap, policy.backoff_base * (1 << std::min(attempt - 1, 20)));
+    std::uniform_real_distribution<double> jitter(0.0, ceiling);
+    return std::chrono::duration<double>(jitter(gen));
+}
+
+// Fetches the neighbors of node on curl, a handle of pool, retrying per policy and sleeping out
+// each backoff on this thread. With a controller every attempt waits for a slot in its window
+// and reports back to it. on_neighbor gets the names of every attempt as they are parsed, so a
+// caller that keeps them must drop those of a failed one: after_attempt, if set, is called once
+// each attempt is over, before any retry. Returns the last attempt's result.
+inline RequestResult fetch_neighbors_blocking(ConnectionPool& pool, CURL* curl, const std::string& service_url,
+                                              const std::string& node, const std::function<void(const char*, size_t)>& on_neighbor,
+                                              const RetryPolicy& policy, ConcurrencyController* controller = nullptr,
+                                              const std::function<void(CURL*, const RequestResult&)>& after_attempt = nullptr) {
+    RequestResult r;
+    for (int attempt = 1;; attempt++) {
+        prepare_request(curl, service_url, node, on_neighbor, policy.deadline_ms);
+        if (controller)
+            controller->acquire();
+        const auto sent = std::chrono::steady_clock::now();
+        const CURLcode result = curl_easy_perform(curl);
+        const std::chrono::duration<double> latency = std::chrono::steady_clock::now() - sent;
+        pool.record(curl);
+        r = finish_request(curl, result);
+        if (controller)
+            controller->release(latency.count(), r.outcome);
+        if (after_attempt)
+            after_attempt(curl, r);
+        if (r.ok || !worth_retrying(policy, r) || attempt >= policy.max_attempts)
+            return r;
+        std::this_thread::sleep_for(retry_backoff(policy, attempt));
+    }
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef NEIGHBOR_STREAM_H
+#define NEIGHBOR_STREAM_H
+
+// Streaming parser for the service's neighbor responses, {"node": ..., "neighbors": [...]},
+// shared by every crawler. It is fed straight from the curl write callback: every complete
+// token in the bytes received so far goes through rapidjson's iterative Reader, each neighbor
+// name reaches the caller's callback as soon as it is parsed, and only the unparsed tail of the
+// response is kept in memory. No DOM is built and no name is copied on the way.
+//
+// A stream is meant to be reused for response after response (reset() before each one), so it
+// keeps its buffer and the Reader's stack and allocates nothing once it has seen a few
+// responses.
+//
+// Parse errors are reported by feed()/finish() and failed(), never thrown: the write callback
+// runs inside curl, which must not be unwound by an exception. Includers must therefore leave
+// RAPIDJSON_PARSE_ERROR_NORETURN at rapidjson's default.
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <string>
+
+#include "rapidjson/reader.h"
+
+// SAX handler that picks the names out of the "neighbors" array, and the "error" message if
+// there is one, as the Reader produces them
+struct NeighborsHandler : rapidjson::BaseReaderHandler<rapidjson::UTF8<>, NeighborsHandler> {
+    enum Field { OTHER, NEIGHBORS, ERROR_MSG };
+
+    const std::function<void(const char*, size_t)>* on_neighbor = nullptr;
+    std::string api_error;
+    int depth = 0;                  // current object/array nesting
+    Field field = OTHER;            // last key seen in the top-level object
+    bool in_neighbors = false;
+
+    bool Key(const char* str, rapidjson::SizeType len, bool) {
+        if (depth == 1) {
+            if (len == 9 && std::string(str, len) == "neighbors")
+                field = NEIGHBORS;
+            else if (len == 5 && std::string(str, len) == "error")
+                field = ERROR_MSG;
+            else
+                field = OTHER;
+        }
+        return true;
+    }
+    bool String(const char* str, rapidjson::SizeType len, bool) {
+        if (in_neighbors && depth == 2)
+            (*on_neighbor)(str, len);
+        else if (depth == 1 && field == ERROR_MSG)
+            api_error.assign(str, len);
+        return true;
+    }
+    bool StartObject() { ++depth; return true; }
+    bool EndObject(rapidjson::SizeType) { --depth; return true; }
+    bool StartArray() {
+        if (depth == 1 && field == NEIGHBORS)
+            in_neighbors = true;
+        ++depth;
+        return true;
+    }
+    bool EndArray(rapidjson::SizeType) {
+        if (--depth == 1)
+            in_neighbors = false;
+        return true;
+    }
+};
+
+// Input stream over the part of the response received so far. Peek() returns '\0' at the
+// end of the buffer, which is only ever reached once the whole response is in.
+struct ChunkStream {
+    typedef char Ch;
+
+    const std::string* buffer;
+    size_t pos = 0;
+    size_t dropped = 0;             // bytes already discarded from the front of buffer
+
+    Ch Peek() const { return pos < buffer->size() ? (*buffer)[pos] : '\0'; }
+    Ch Take() { return pos < buffer->size() ? (*buffer)[pos++] : '\0'; }
+    size_t Tell() const { return dropped + pos; }
+
+    // Write side of the stream concept, only used by in-situ parsing
+    Ch* PutBegin() { RAPIDJSON_ASSERT(false); return 0; }
+    void Put(Ch) { RAPIDJSON_ASSERT(false); }
+    void Flush() { RAPIDJSON_ASSERT(false); }
+    size_t PutEnd(Ch*) { RAPIDJSON_ASSERT(false); return 0; }
+};
+
+// Incremental neighbor parser for one response at a time
+class NeighborStream {
+public:
+    NeighborStream() {
+        stream.buffer = &buffer;
+        buffer.reserve(INITIAL_BUFFER);
+    }
+
+    NeighborStream(const NeighborStream&) = delete;
+    NeighborStream& operator=(const NeighborStream&) = delete;
+
+    // Starts on a new response; on_neighbor must outlive it
+    void reset(const std::function<void(const char*, size_t)>& on_neighbor) {
+        handler = NeighborsHandler();
+        handler.on_neighbor = &on_neighbor;
+        buffer.clear();
+        stream.pos = stream.dropped = 0;
+        parsing = std::chrono::steady_clock::duration(0);
+        reader.IterativeParseInit();
+    }
+
+    // Returns false once the response is known to be malformed
+    bool feed(const char* data, size_t len) {
+        const auto start = std::chrono::steady_clock::now();
+        buffer.append(data, len);
+        while (!reader.IterativeParseComplete() && has_complete_token())
+            reader.IterativeParseNext<rapidjson::kParseDefaultFlags>(stream, handler);
+
+        // Drop the consumed prefix so a large response never sits in memory as a whole
+        if (stream.pos > 4096 && stream.pos * 2 > buffer.size()) {
+            buffer.erase(0, stream.pos);
+            stream.dropped += stream.pos;
+            stream.pos = 0;
+        }
+        parsing += std::chrono::steady_clock::now() - start;
+        return !reader.HasParseError();
+    }
+
+    // Parses whatever is left once the transfer is over
+    bool finish() {
+        const auto start = std::chrono::steady_clock::now();
+        while (!reader.IterativeParseComplete())
+            reader.IterativeParseNext<rapidjson::kParseDefaultFlags>(stream, handler);
+        parsing += std::chrono::steady_clock::now() - start;
+        return !reader.HasParseError();
+    }
+
+    // Time spent parsing, including handing the names to on_neighbor
+    std::chrono::steady_clock::duration parse_time() const { return parsing; }
+
+    // The response's "error" message, empty if it had none
+    const std::string& api_error() const { return handler.api_error; }
+
+    bool failed() const { return reader.HasParseError(); }
+    rapidjson::ParseErrorCode error_code() const { return reader.GetParseErrorCode(); }
+    size_t error_offset() const { return reader.GetErrorOffset(); }
+
+    // curl write callback; CURLOPT_WRITEDATA is the stream. Returning short of the received
+    // size aborts the transfer with CURLE_WRITE_ERROR once the response is malformed.
+    static size_t write_callback(void* contents, size_t size, size_t nmemb, void* userdata) {
+        const size_t total = size * nmemb;
+        NeighborStream* self = static_cast<NeighborStream*>(userdata);
+        try {
+            if (!self->feed(static_cast<const char*>(contents), total))
+                return 0;
+        } catch (const std::bad_alloc&) {
+            return 0;
+        }
+        return total;
+    }
+
+private:
+    // IterativeParseNext() skips delimiters and stops after the first token that reaches the
+    // handler, so it may only run when such a token is fully buffered: a partial string or
+    // number at the end of the buffer would otherwise be reported as a syntax error.
+    bool has_complete_token() const {
+        const std::string& b = buffer;
+        size_t i = stream.pos;
+        while (i < b.size() && (b[i] == ' ' || b[i] == '\t' || b[i] == '\n' || b[i] == '\r' || b[i] == ',' || b[i] == ':'))
+            i++;
+        if (i == b.size())
+            return false;
+        char c = b[i];
+        if (c == '{' || c == '}' || c == '[' || c == ']')
+            return true;
+        if (c == '"') {
+            for (i++; i < b.size(); i++) {
+                if (b[i] == '\\')
+                    i++;
+                else if (b[i] == '"')
+                    return true;
+            }
+            return false;
+        }
+        // number or literal: complete once the character after it has arrived
+        while (i < b.size() && b[i] != ',' && b[i] != ']' && b[i] != '}' && b[i] != ' ' && b[i] != '\n' && b[i] != '\r' && b[i] != '\t')
+            i++;
+        return i < b.size();
+    }
+
+    static const size_t INITIAL_BUFFER = 16 * 1024;
+
+    rapidjson::Reader reader;
+    NeighborsHandler handler;
+    std::string buffer;
+    ChunkStream stream;
+    std::chrono::steady_clock::duration parsing{0};
+};
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef NODE_WRITER_H
+#define NODE_WRITER_H
+
+// Output stage of a crawl. Workers hand over batches of finished nodes as soon as they are known,
+// and a single writer thread formats them into a large buffer and writes it out. A crawl no
+// longer has to hold every node until it ends, and the first lines appear while it is still
+// running.
+//
+// Producers never take a lock. Batches go through an intrusive multi-producer single-consumer
+// queue (Vyukov): a push is one atomic exchange and one store, plus a notify only when the writer
+// is asleep. While the queue is empty the writer sleeps, waking at the latest FLUSH_INTERVAL_MS
+// after its last write to flush what it has buffered. A busy crawl gets megabyte writes and a
+// slow one still streams.
+//
+// Formats:
+//   text    "- <name>" per node and "Level size: <n>" after each level, as the crawlers printed
+//   jsonl   {"node": <name>, "level": <level>} per node
+//   binary  the magic "HGNODES1", then per node a varint level, a varint length and the name
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+enum class OutputFormat { TEXT, JSONL, BINARY };
+
+// Parses "text", "jsonl" or "binary"; returns false for anything else
+inline bool parse_output_format(const std::string& name, OutputFormat& format) {
+    if (name == "text")
+        format = OutputFormat::TEXT;
+    else if (name == "jsonl")
+        format = OutputFormat::JSONL;
+    else if (name == "binary")
+        format = OutputFormat::BINARY;
+    else
+        return false;
+    return true;
+}
+
+class NodeWriter {
+public:
+    // Writes to path, or to standard output if path is empty or "-". Throws std::runtime_error
+    // if the file can't be created.
+    NodeWriter(const std::string& path, OutputFormat format)
+        : format(format), started(std::chrono::steady_clock::now()) {
+        if (path.empty() || path == "-") {
+            fd = STDOUT_FILENO;
+        } else {
+            fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                throw std::runtime_error("cannot create " + path);
+        }
+        head.store(&stub);
+        tail = &stub;
+        buffer.reserve(BUFFER_BYTES + 4096);
+        if (format == OutputFormat::BINARY)
+            buffer.append("HGNODES1", 8);
+        writer = std::thread(&NodeWriter::write_loop, this);
+    }
+
+    // Collects the output in *sink instead, for callers that frame it themselves
+    NodeWriter(std::string* sink, OutputFormat format)
+        : format(format), started(std::chrono::steady_clock::now()), fd(-1), sink(sink) {
+        head.store(&stub);
+        tail = &stub;
+        if (format == OutputFormat::BINARY)
+            buffer.append("HGNODES1", 8);
+        writer = std::thread(&NodeWriter::write_loop, this);
+    }
+
+    ~NodeWriter() {
+        close();
+        if (fd >= 0 && fd != STDOUT_FILENO)
+            ::close(fd);
+    }
+
+    NodeWriter(const NodeWriter&) = delete;
+    NodeWriter& operator=(const NodeWriter&) = delete;
+
+    // Queues nodes of one level; any thread may call this
+    void write(int level, std::vector<std::string>&& names) {
+        if (names.empty())
+            return;
+        Batch* batch = new Batch;
+        batch->level = level;
+        batch->names.swap(names);
+        push(batch);
+    }
+
+    // Marks the end of a level of the given size (printed by the text format only)
+    void end_level(int level, size_t size) {
+        Batch* batch = new Batch;
+        batch->level = level;
+        batch->level_size = size;
+        push(batch);
+    }
+
+    // Writes out everything queued so far and stops the writer. Call it once every producer is
+    // done; later calls do nothing.
+    void close() {
+        if (!writer.joinable())
+            return;
+        closing.store(true);
+        {
+            std::lock_guard<std::mutex> lock(m);
+            wakeup.notify_one();
+        }
+        writer.join();
+    }
+
+    bool ok() const { return !failed; }
+
+    // Nodes and bytes written, and when the first node went out (valid after close)
+    void print_summary(std::ostream& out) const {
+        out << "Output: " << nodes << " nodes, " << bytes << " bytes in " << writes << " writes";
+        if (first_write_ms >= 0)
+            out << ", first after " << first_write_ms << "ms";
+        out << "\n";
+    }
+
+private:
+    static const size_t BUFFER_BYTES = 1 << 20;
+    static const int FLUSH_INTERVAL_MS = 50;
+
+    struct Batch {
+        std::atomic<Batch*> next{nullptr};
+        int level = 0;
+        long level_size = -1;       // >= 0 marks the end of a level
+        std::vector<std::string> names;
+    };
+
+    void push(Batch* batch) {
+        Batch* previous = head.exchange(batch, std::memory_order_acq_rel);
+        // Sequentially consistent, like the writer's side in write_loop: either the writer sees
+        // this batch before it sleeps, or we see it sleeping and wake it
+        previous->next.store(batch);
+        if (sleeping.load()) {
+            std::lock_guard<std::mutex> lock(m);
+            wakeup.notify_one();
+        }
+    }
+
+    // Takes the oldest batch's contents into out; the writer thread only. The node that held
+    // them becomes the queue's new stub.
+    bool pop(Batch& out) {
+        Batch* next = tail->next.load(std::memory_order_acquire);
+        if (!next)
+            return false;
+        out.level = next->level;
+        out.level_size = next->level_size;
+        out.names.swap(next->names);
+        if (tail != &stub)
+            delete tail;
+        tail = next;
+        return true;
+    }
+
+    void write_loop() {
+        Batch batch;
+        for (;;) {
+            if (pop(batch)) {
+                format_batch(batch);
+                batch.names.clear();
+                if (buffer.size() >= BUFFER_BYTES)
+                    flush();
+                continue;
+            }
+            // Nothing queued: get what we have out early, then wait for more
+            if (std::chrono::steady_clock::now() - last_flush >= std::chrono::milliseconds(FLUSH_INTERVAL_MS))
+                flush();
+            if (closing.load()) {
+                if (pop(batch)) {
+                    format_batch(batch);
+                    continue;
+                }
+                break;
+            }
+            std::unique_lock<std::mutex> lock(m);
+            sleeping.store(true);
+            wakeup.wait_until(lock, last_flush + std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this]() {
+                return tail->next.load() || closing.load();
+            });
+            sleeping.store(false, std::memory_order_relaxed);
+        }
+        flush();
+        if (tail != &stub)
+            delete tail;
+        tail = &stub;
+    }
+
+    void format_batch(const Batch& batch) {
+        if (batch.level_size >= 0) {
+            if (format == OutputFormat::TEXT)
+                buffer += "Level size: " + std::to_string(batch.level_size) + "\n";
+            return;
+        }
+        for (const std::string& name : batch.names) {
+            switch (format) {
+            case OutputFormat::TEXT:
+                buffer += "- ";
+                buffer += name;
+                buffer += '\n';
+                break;
+            case OutputFormat::JSONL:
+                buffer += "{\"node\": ";
+                append_json_string(name);
+                buffer += ", \"level\": " + std::to_string(batch.level) + "}\n";
+                break;
+            case OutputFormat::BINARY:
+                append_varint(batch.level);
+                append_varint(name.size());
+                buffer += name;
+                break;
+            }
+        }
+        nodes += batch.names.size();
+    }
+
+    void append_json_string(const std::string& s) {
+        static const char HEX[] = "0123456789abcdef";
+        buffer += '"';
+        for (char c : s) {
+            switch (c) {
+            case '"': buffer += "\\\""; break;
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\t': buffer += "\\t"; break;
+            case '\r': buffer += "\\r"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    buffer += "\\u00";
+                    buffer += HEX[c >> 4];
+                    buffer += HEX[c & 15];
+                } else {
+                    buffer += c;
+                }
+            }
+        }
+        buffer += '"';
+    }
+
+    void append_varint(uint64_t v) {
+        while (v >= 0x80) {
+            buffer += char(v | 0x80);
+            v >>= 7;
+        }
+        buffer += char(v);
+    }
+
+    void flush() {
+        last_flush = std::chrono::steady_clock::now();
+        if (buffer.empty())
+            return;
+        const char* p = buffer.data();
+        size_t left = buffer.size();
+        if (sink) {
+            sink->append(p, left);
+            left = 0;
+        }
+        while (left > 0 && !failed) {
+            ssize_t n = ::write(fd, p, left);
+            if (n <= 0)
+                failed = true;
+            else {
+                p += n;
+                left -= n;
+            }
+        }
+        if (first_write_ms < 0 && nodes > 0)
+            first_write_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+        bytes += buffer.size();
+        writes++;
+        buffer.clear();
+    }
+
+    const OutputFormat format;
+    const std::chrono::steady_clock::time_point started;
+    int fd;
+    std::string* sink = nullptr;
+
+    std::atomic<Batch*> head;       // newest batch, pushed to by producers
+    Batch* tail;                    // stub in front of the oldest batch, writer thread only
+    Batch stub;
+    std::atomic<bool> closing{false};
+    std::atomic<bool> sleeping{false};  // the writer is in (or about to enter) its wait
+    std::mutex m;                   // only for the writer's wait and the wakeups
+    std::condition_variable wakeup;
+    std::thread writer;
+
+    // Writer thread only until close() returns
+    std::string buffer;
+    bool failed = false;
+    uint64_t nodes = 0, bytes = 0, writes = 0;
+    long first_write_ms = -1;
+    std::chrono::steady_clock::time_point last_flush;
+};
+
+const int NodeWriter::FLUSH_INTERVAL_MS;
+
+#endif
@@ -1,22 +1,56 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <list>
+#include <queue>
 #include <unordered_set>
+#include <unordered_map>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <atomic>
 #include <algorithm>
+#include <cassert>
+#include <functional>
+#include <memory>
+#include <random>
+#include <cstdlib>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <curl/curl.h>
-#include "rapidjson/document.h"
+#include "rapidjson/error/en.h"
+#include "neighbor_stream.h"
+#include "connection_pool.h"
+#include "concurrency_controller.h"
+#include "neighbor_fetch.h"
+#include "crawl_journal.h"
+#include "crawl_snapshot.h"
+#include "direction_bfs.h"
+#include "visited_names.h"
+#include "node_writer.h"
+#include "crawl_telemetry.h"
 
 using namespace std;
 using namespace rapidjson;
 
-const string SERVICE_URL = "http://hollywood-graph-crawler.bridgesuncc.org/neighbors/";
-const int MAX_THREADS = 8;  // Maximum threads to use per level
+// HOLLYWOOD_SERVICE_URL overrides the server, e.g. to crawl the local mock
+string service_url() {
+    const char* root = getenv("HOLLYWOOD_SERVICE_URL");
+    return string(root ? root : "http://hollywood-graph-crawler.bridgesuncc.org") + "/neighbors/";
+}
+const string SERVICE_URL = service_url();
 
-// Mutexes for thread synchronization
-mutex visited_mutex;    // Protects the visited nodes set
-mutex next_level_mutex; // Protects the next level nodes vector
+// Requests in flight: start where the fixed thread count used to be, let the controller adapt
+const int INITIAL_CONCURRENCY = 8;
+const int DEFAULT_MAX_CONCURRENCY = 64;
 
 struct ParseException : std::runtime_error, rapidjson::ParseResult {
     ParseException(rapidjson::ParseErrorCode code, const char* msg, size_t offset) : 
@@ -24,198 +58,1720 @@ struct ParseException : std::runtime_error, rapidjson::ParseResult {
         rapidjson::ParseResult(code, offset) {}
 };
 
+bool debug = false;
 
-// Function to HTTP ecnode parts of URLs. for instance, replace spaces with '%20' for URLs
-string url_encode(CURL* curl, string input) {
-    char* out = curl_easy_escape(curl, input.c_str(), input.size());
-    string s = out;
-    curl_free(out);
-    return s;
+// Function to pick the q-quantile of a sample (by value, it gets reordered)
+double percentile(vector<double> samples, double q) {
+    if (samples.empty())
+        return 0.0;
+    size_t k = min(samples.size() - 1, (size_t)(q * samples.size()));
+    nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
 }
 
-// Callback function for writing response data
-size_t WriteCallback(void* contents, size_t size, size_t nmemb, string* output) {
-    size_t totalSize = size * nmemb;
-    output->append((char*)contents, totalSize);
-    return totalSize;
-}
+// Rolling window of recent successful request latencies, used to decide when an outstanding
+// request has become slow enough to be worth hedging
+class LatencyTracker {
+public:
+    void add(double seconds) {
+        lock_guard<mutex> lock(m);
+        if (samples.size() < WINDOW)
+            samples.push_back(seconds);
+        else
+            samples[next++ % WINDOW] = seconds;
+    }
 
-bool debug = false;
+    // Negative until enough requests have completed to trust the estimate
+    double percentile(double q) const {
+        lock_guard<mutex> lock(m);
+        if (samples.size() < MIN_SAMPLES)
+            return -1.0;
+        return ::percentile(samples, q);
+    }
 
-// Function to fetch neighbors using libcurl with debugging
-string fetch_neighbors(CURL* curl, const string& node) {
-    string url = SERVICE_URL + url_encode(curl, node);
-    string response;
+private:
+    static const size_t WINDOW = 512;
+    static const size_t MIN_SAMPLES = 20;
 
-    if (debug)
-        cout << "Sending request to: " << url << endl;
+    mutable mutex m;
+    vector<double> samples;
+    size_t next = 0;
+};
 
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
-    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+// Per-level request statistics: how long each node took from its first attempt to its final
+// answer, and how often that needed a retry or a hedge
+class CrawlStats {
+public:
+    void record(int level, double seconds, int retries, bool hedged, bool hedge_won, bool failed) {
+        lock_guard<mutex> lock(m);
+        if ((int)levels.size() <= level)
+            levels.resize(level + 1);
+        Level& l = levels[level];
+        l.completion.push_back(seconds);
+        l.retries += retries;
+        l.hedges += hedged;
+        l.hedge_wins += hedge_won;
+        l.failures += failed;
+    }
 
-    // curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L); // Verbose Logging
+    void print_summary(ostream& out) const {
+        lock_guard<mutex> lock(m);
+        for (size_t d = 0; d < levels.size(); d++) {
+            const Level& l = levels[d];
+            out << "Level " << d << " requests: " << l.completion.size()
+                << ", completion p50 " << percentile(l.completion, 0.50) << "s"
+                << ", p99 " << percentile(l.completion, 0.99) << "s"
+                << ", " << l.retries << " retries, " << l.hedges << " hedged (" << l.hedge_wins << " won)"
+                << ", " << l.failures << " failed\n";
+        }
+    }
 
-    // Set a User-Agent header to avoid potential blocking by the server
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "User-Agent: C++-Client/1.0");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+private:
+    struct Level {
+        vector<double> completion;
+        long retries = 0, hedges = 0, hedge_wins = 0, failures = 0;
+    };
 
-    CURLcode res = curl_easy_perform(curl);
+    mutable mutex m;
+    vector<Level> levels;
+};
 
-    if (res != CURLE_OK) {
-        cerr << "CURL error: " << curl_easy_strerror(res) << endl;
-    } else if (debug) {
-        cout << "CURL request successful!" << endl;
+// Neighbor lists shared by every query of a server. Each name is interned once, as a key of the
+// table, and a list is a vector of pointers to those keys. A node that one query is fetching is
+// not fetched again by another: the second waits for the first to finish.
+class NeighborCache {
+public:
+    // Returns true with the node's neighbors if they are known, waiting for a fetch in progress.
+    // Otherwise claims the node and returns false, and the caller must fetch it and call finish().
+    bool claim(const string& node, vector<const string*>& neighbors) {
+        unique_lock<mutex> lock(m);
+        Entry& e = nodes[node];
+        cv.wait(lock, [&]() { return e.state != FETCHING; });
+        if (e.state == READY) {
+            neighbors = e.neighbors;
+            hits++;
+            return true;
+        }
+        e.state = FETCHING;
+        return false;
     }
 
-    curl_slist_free_all(headers);
+    // Stores the list of a claimed node, or releases the claim if the fetch failed (fetched null)
+    void finish(const string& node, const vector<string>* fetched) {
+        lock_guard<mutex> lock(m);
+        Entry& e = nodes[node];
+        if (fetched) {
+            e.neighbors.reserve(fetched->size());
+            for (const string& name : *fetched)
+                e.neighbors.push_back(&nodes.emplace(name, Entry()).first->first);
+            e.state = READY;
+            edges += fetched->size();
+            lists++;
+        } else {
+            e.state = UNKNOWN;
+        }
+        cv.notify_all();
+    }
 
-    if (debug) 
-        cout << "Response received: " << response << endl;
+    void print_summary(ostream& out) const {
+        lock_guard<mutex> lock(m);
+        out << "Neighbor cache: " << lists << " lists, " << nodes.size() << " interned names, " << edges
+            << " edges, " << hits << " hits\n";
+    }
 
-    return (res == CURLE_OK) ? response : "{}";
-}
+private:
+    enum State { UNKNOWN, FETCHING, READY };
 
-    // Parses JSON response to extract neighbor nodes
-vector<string> get_neighbors(const string& json_str) {
-    vector<string> neighbors;
-    Document doc;
-    doc.Parse(json_str.c_str());
-    
-    if (doc.HasParseError()) {
-        throw ParseException(doc.GetParseError(), "JSON parse error", doc.GetErrorOffset());
+    struct Entry {
+        State state = UNKNOWN;
+        vector<const string*> neighbors;    // keys of nodes
+    };
+
+    mutable mutex m;
+    condition_variable cv;
+    unordered_map<string, Entry> nodes;
+    long lists = 0, edges = 0, hits = 0;
+};
+
+// Fixed set of crawl workers, each with its own CURL handle, that run the fetches of any number
+// of crawls. A server shares one set between its queries, so concurrent queries fill one request
+// window instead of each bringing a window's worth of threads. A crawl with nodes queued is
+// scheduled here, and the workers give the scheduled crawls a turn each in order, so a big query
+// does not hold up the small ones.
+class CrawlWorkers {
+public:
+    // A crawl as the workers see it
+    class Job {
+    public:
+        virtual ~Job() {}
+
+        // One turn: expands some of the queued nodes with curl. A job schedules itself again
+        // while it has nodes queued, but is never in the schedule twice.
+        virtual void step(CURL* curl) = 0;
+    };
+
+    CrawlWorkers(ConnectionPool& pool, int num_workers, CrawlTelemetry* telemetry = nullptr)
+        : pool(pool), telemetry(telemetry) {
+        for (int i = 0; i < num_workers; i++)
+            workers.emplace_back(&CrawlWorkers::worker, this);
     }
-    
-    if (doc.HasMember("neighbors") && doc["neighbors"].IsArray()) {
-        for (const auto& neighbor : doc["neighbors"].GetArray()) {
-            neighbors.push_back(neighbor.GetString());
+
+    // Every job must have finished by now; the workers just leave
+    ~CrawlWorkers() {
+        {
+            lock_guard<mutex> lock(m);
+            stopping = true;
         }
+        cv.notify_all();
+        for (auto& t : workers)
+            t.join();
     }
-    return neighbors;
-}
 
+    int size() const { return (int)workers.size(); }
 
-// Thread worker function to process a single node
-void process_node(CURL* curl, const string& node, unordered_set<string>& visited, vector<string>& next_level) {
-    try {
-        if (debug)
-            cout << "Processing node: " << node << endl;
-        
-        // Get neighbors through API call
-        vector<string> neighbors = get_neighbors(fetch_neighbors(curl, node));
+    // Gives job a turn once a worker is free
+    void schedule(Job* job) {
+        {
+            lock_guard<mutex> lock(m);
+            runnable.push_back(job);
+        }
+        cv.notify_one();
+    }
 
-        for (const auto& neighbor : neighbors) {
-            // Thread-safe check/update of visited set
-            unique_lock<mutex> visited_lock(visited_mutex);
-            if (!visited.count(neighbor)) {
-                visited.insert(neighbor);
-                visited_lock.unlock();
-                
-                unique_lock<mutex> next_level_lock(next_level_mutex);
-                next_level.push_back(neighbor);
+private:
+    void worker() {
+        CURL* curl = pool.acquire();    // Each worker keeps its own CURL handle
+        if (!curl) {
+            cerr << "Failed to initialize CURL in thread" << endl;
+            return;
+        }
+
+        unique_lock<mutex> lock(m);
+        auto has_work = [&]() { return !runnable.empty() || stopping; };
+        for (;;) {
+            if (telemetry && !has_work()) {
+                const auto idle_since = chrono::steady_clock::now();
+                cv.wait(lock, has_work);
+                telemetry->record(CrawlTelemetry::IDLE, chrono::steady_clock::now() - idle_since);
+            } else {
+                cv.wait(lock, has_work);
             }
+            if (runnable.empty())
+                break;
+            Job* job = runnable.front();
+            runnable.pop_front();
+            lock.unlock();
+            job->step(curl);
+            lock.lock();
         }
-    } catch (const ParseException& e) {
-        cerr << "Error while fetching neighbors of: " << node << endl;
-        throw e;
+        lock.unlock();
+        pool.release(curl);
     }
+
+    ConnectionPool& pool;
+    CrawlTelemetry* telemetry;
+    vector<thread> workers;
+
+    mutex m;                    // Protects runnable and stopping
+    condition_variable cv;
+    deque<Job*> runnable;
+    bool stopping = false;
+};
+
+// Everything a worker needs to fetch neighbors
+struct FetchContext {
+    ConnectionPool& pool;
+    ConcurrencyController& controller;
+    RetryPolicy policy;
+    LatencyTracker latencies;
+    CrawlStats stats;
+    const CrawlSnapshot* snapshot = nullptr;    // answers for the nodes it has expanded
+    SnapshotBuilder* recorder = nullptr;        // records every expanded node for --export
+    NeighborCache* cache = nullptr;             // shared by the queries of a server
+    CrawlWorkers* workers = nullptr;            // a server's; without them a crawl starts its own
+    CrawlTelemetry* telemetry = nullptr;        // --telemetry / --telemetry-live
+    atomic<long> snapshot_hits{0};
+    atomic<long> cache_hits{0};
+    atomic<long> fetches{0};                    // nodes that went to the network
+
+    FetchContext(ConnectionPool& pool, ConcurrencyController& controller, const RetryPolicy& policy)
+        : pool(pool), controller(controller), policy(policy) {}
+};
+
+// What came of a single attempt
+struct AttemptResult {
+    bool ok = false;
+    bool retryable = false;
+    bool malformed = false;
+    bool hedged = false;
+    bool hedge_won = false;
+};
+
+// Function to fetch neighbors using libcurl with debugging. The response is parsed while it is
+// being received. The transfer runs on a multi handle so that, with hedging on, a duplicate
+// request can be started once the first one is slower than the observed p95; whichever
+// answers first wins and the other one is cancelled. Both feed the same on_neighbor, which is
+// fine since interning a name twice is a no-op. The list that gets stored is another matter:
+// with `names` set, each transfer collects its own names and only the winner's end up there.
+AttemptResult fetch_neighbors(FetchContext& ctx, CURL* curl, const string& node, const function<void(const char*, size_t)>& on_neighbor,
+                              vector<string>* names = nullptr) {
+    struct Transfer {
+        CURL* curl = nullptr;
+        vector<string> names;               // what this transfer parsed, when names are wanted
+        function<void(const char*, size_t)> recording;
+        chrono::steady_clock::time_point sent;
+        bool running = false;
+    };
+    Transfer transfers[2];      // the request and its hedge
+    int started = 0, running = 0;
+    CURLM* multi = ctx.pool.acquire_multi();
+
+    auto start_transfer = [&](CURL* handle) {
+        Transfer& t = transfers[started++];
+        t.curl = handle;
+        if (names) {
+            t.recording = [&t, &on_neighbor](const char* name, size_t len) {
+                t.names.emplace_back(name, len);
+                on_neighbor(name, len);
+            };
+        }
+        prepare_request(handle, SERVICE_URL, node, names ? t.recording : on_neighbor, ctx.policy.deadline_ms);
+        if (debug && started == 1)
+            cout << "Sending request to: " << FetchBuffers::of(handle).url << endl;
+        t.sent = chrono::steady_clock::now();
+        t.running = true;
+        running++;
+        curl_multi_add_handle(multi, handle);
+    };
+
+    ctx.controller.acquire();
+    start_transfer(curl);
+    double hedge_after = ctx.policy.hedge ? ctx.latencies.percentile(0.95) : -1.0;
+
+    AttemptResult result;
+    while (!result.ok && running > 0) {
+        int still_running = 0;
+        curl_multi_perform(multi, &still_running);
+
+        CURLMsg* msg;
+        int queued;
+        while ((msg = curl_multi_info_read(multi, &queued))) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            int i = msg->easy_handle == transfers[0].curl ? 0 : 1;
+            Transfer& t = transfers[i];
+            CURLcode res = msg->data.result;
+            const chrono::duration<double> latency = chrono::steady_clock::now() - t.sent;
+            curl_multi_remove_handle(multi, t.curl);
+            t.running = false;
+            running--;
+            ctx.pool.record(t.curl);
+            if (ctx.telemetry)
+                ctx.telemetry->record_transfer(t.curl);
+
+            const RequestResult r = finish_request(t.curl, res);
+            ctx.controller.release(latency.count(), r.outcome);
+
+            if (r.ok) {
+                if (!result.ok) {
+                    result.ok = true;
+                    result.hedge_won = (i == 1);
+                    if (names)
+                        names->swap(t.names);
+                    ctx.latencies.add(latency.count());
+                    if (ctx.telemetry)
+                        ctx.telemetry->record(CrawlTelemetry::PARSE, FetchBuffers::of(t.curl).stream.parse_time());
+                }
+            } else if (r.malformed) {
+                result.malformed = true;
+            } else {
+                cerr << "CURL error: " << curl_easy_strerror(res) << endl;
+                if (r.retryable)
+                    result.retryable = true;
+            }
+        }
+        if (result.ok || running == 0)
+            break;
+
+        int wait_ms = 100;
+        if (started == 1 && hedge_after > 0) {
+            const chrono::duration<double> elapsed = chrono::steady_clock::now() - transfers[0].sent;
+            if (elapsed.count() >= hedge_after) {
+                // Only hedge into spare capacity, never past the concurrency window
+                if (ctx.controller.try_acquire()) {
+                    CURL* hedge = ctx.pool.acquire();
+                    if (hedge) {
+                        start_transfer(hedge);
+                        result.hedged = true;
+                        if (debug)
+                            cout << "Hedging request for: " << node << endl;
+                        continue;
+                    }
+                    ctx.controller.release(0, ConcurrencyController::CANCELLED);
+                }
+            } else {
+                wait_ms = max(1, min(wait_ms, (int)((hedge_after - elapsed.count()) * 1000)));
+            }
+        }
+        curl_multi_poll(multi, nullptr, 0, wait_ms, nullptr);
+    }
+
+    // Cancel whatever lost the race
+    for (int i = 0; i < started; i++) {
+        if (transfers[i].running) {
+            curl_multi_remove_handle(multi, transfers[i].curl);
+            ctx.controller.release(0, ConcurrencyController::CANCELLED);
+        }
+    }
+    if (started == 2)
+        ctx.pool.release(transfers[1].curl);
+    ctx.pool.release_multi(multi);
+
+    if (result.ok)
+        result.malformed = result.retryable = false;
+    else if (debug)
+        cout << "Attempt failed for: " << node << endl;
+    return result;
 }
 
-// Parallel BFS implementation
-vector<vector<string>> parallel_bfs(CURL* curl, const string& start, int depth) {
-    vector<vector<string>> levels;
-    unordered_set<string> visited;
-    
-    levels.push_back({start});
-    visited.insert(start);
-
-    // Process each level
-    for (int d = 0; d < depth; d++) {
-        if (debug)
-            cout << "Starting level: " << d << " with " << levels[d].size() << " nodes" << endl;
-
-        // Prepare next level storage
-        levels.push_back({});
-        vector<string>& current_level = levels[d];
-        vector<string>& next_level = levels[d+1];
-        
-        // Determine thread count for this level
-        int num_nodes = current_level.size();
-        int num_threads = min(num_nodes, MAX_THREADS);
-        
-        vector<thread> threads;
-        int nodes_per_thread = (num_nodes + num_threads - 1) / num_threads;
-        
-        // Create worker threads
-        for (int t = 0; t < num_threads; t++) {
-            int start_idx = t * nodes_per_thread;
-            int end_idx = min((t + 1) * nodes_per_thread, num_nodes);
-            
-            threads.emplace_back([&, start_idx, end_idx]() {
-                CURL* thread_curl = curl_easy_init();   // Each thread gets its own CURL handle
-                if (!thread_curl) {
-                    cerr << "Failed to initialize CURL in thread" << endl;
-                    return;
+// Function to stream the neighbors of a node to on_neighbor, one name at a time, as they are
+// parsed out of the response. Failed attempts are retried with backoff; a node that still fails
+// is reported instead of silently coming back empty. A malformed response throws.
+bool get_neighbors(FetchContext& ctx, CURL* curl, const string& node, int level, const function<void(const char*, size_t)>& forward) {
+    vector<string> fetched;
+    const bool keep = ctx.recorder || ctx.cache;
+    function<void(const char*, size_t)> recording;
+    if (keep) {
+        recording = [&fetched, &forward](const char* name, size_t len) {
+            fetched.emplace_back(name, len);
+            forward(name, len);
+        };
+    }
+    const function<void(const char*, size_t)>& on_neighbor = recording ? recording : forward;
+
+    // Only nodes the snapshot has not expanded go to the network
+    if (ctx.snapshot && ctx.snapshot->neighbors(node, on_neighbor)) {
+        ctx.snapshot_hits++;
+        if (ctx.recorder)
+            ctx.recorder->add(node, fetched);
+        return true;
+    }
+
+    // So do the nodes another query of the server has fetched, or is fetching right now
+    vector<const string*> cached;
+    if (ctx.cache && ctx.cache->claim(node, cached)) {
+        ctx.cache_hits++;
+        for (const string* name : cached)
+            on_neighbor(name->data(), name->size());
+        if (ctx.recorder)
+            ctx.recorder->add(node, fetched);
+        return true;
+    }
+
+    const auto first_sent = chrono::steady_clock::now();
+    AttemptResult result;
+    int retries = 0;
+    bool hedged = false, hedge_won = false;
+    ctx.fetches++;
+    for (;;) {
+        // Names of a failed attempt, or of a hedge that lost, were forwarded already but are not kept
+        result = fetch_neighbors(ctx, curl, node, forward, keep ? &fetched : nullptr);
+        hedged |= result.hedged;
+        hedge_won |= result.hedge_won;
+        if (result.ok || !result.retryable || retries + 1 >= ctx.policy.max_attempts)
+            break;
+        retries++;
+        this_thread::sleep_for(retry_backoff(ctx.policy, retries));
+    }
+    const chrono::duration<double> elapsed = chrono::steady_clock::now() - first_sent;
+    ctx.stats.record(level, elapsed.count(), retries, hedged, hedge_won, !result.ok);
+    if (ctx.cache)
+        ctx.cache->finish(node, result.ok ? &fetched : nullptr);
+
+    if (result.malformed)
+        throw ParseException(kParseErrorTermination, "malformed neighbors response", 0);
+    if (!result.ok)
+        cerr << "Failed to fetch neighbors of: " << node << " after " << retries + 1 << " attempts" << endl;
+    else if (ctx.recorder)
+        ctx.recorder->add(node, fetched);
+    return result.ok;
+}
+
+// Pipelined parallel BFS. Persistent workers (CrawlWorkers) take nodes from one shared queue in
+// chunks that shrink as the queue drains, and there is no barrier between levels: a node is
+// queued as soon as its parent's response has been merged, so the next level's fetches overlap
+// the slow tail of the current one.
+//
+// Depths stay exact because merging, unlike fetching, happens in level order. The neighbors of
+// a level-d node may only be assigned to level d+1 once every level-(d-1) node has been merged,
+// since only then is level d final. Names that arrive before that are stashed with their node
+// and merged as soon as the level becomes final.
+//
+// A level goes to the output as soon as it is final, and its names are dropped once all of its
+// nodes have been merged, so at most two levels are held at a time.
+class PipelinedBFS : CrawlWorkers::Job {
+public:
+    PipelinedBFS(FetchContext& ctx, VisitedNames& visited, NodeWriter& out, const string& start, int depth,
+                 CrawlJournal* journal = nullptr)
+        : ctx(ctx), depth(depth), journal(journal), out(out), visited(visited), levels(depth + 1), merged(depth + 1, 0),
+          waiting(depth + 1) {
+        assert(depth >= 0);     // level 0 always exists: the start node is interned into it below
+        if (journal && !journal->recovered().empty())
+            recover();
+        else
+            intern(start.data(), start.size(), 0);
+        publish(0);
+        advance();
+    }
+
+    // Crawls on the server's workers, or on a set of its own
+    void run() {
+        if (ctx.workers) {
+            run(*ctx.workers);
+        } else {
+            CrawlWorkers own(ctx.pool, ctx.controller.max_window(), ctx.telemetry);
+            run(own);
+        }
+    }
+
+private:
+    // Tasks point into the levels, which hold every name exactly once
+    struct Task {
+        const string* node;
+        int level;
+        uint32_t id;        // discovery number in the journal
+    };
+
+    // Neighbors of a fetched node, kept until its level is final
+    struct Stash {
+        uint32_t id;
+        vector<string> names;
+    };
+
+    static const size_t MAX_CHUNK = 8;
+
+    void run(CrawlWorkers& on) {
+        unique_lock<mutex> lock = lock_state();
+        workers = &on;
+        num_workers = on.size();
+        if (!queue.empty()) {
+            scheduled = true;
+            workers->schedule(this);
+        }
+        cv.wait(lock, [&]() { return final_level >= depth && !scheduled && turns == 0; });
+    }
+
+    // A worker's turn: expands a chunk of the queue
+    void step(CURL* curl) override {
+        vector<Task> chunk;
+        {
+            unique_lock<mutex> lock = lock_state();
+            // Guided self-scheduling: big chunks while there is plenty of work, single nodes
+            // near the end so that no worker sits on a backlog while others idle
+            size_t take = min(queue.size(), max<size_t>(1, min(MAX_CHUNK, queue.size() / (2 * num_workers))));
+            for (size_t i = 0; i < take; i++) {
+                chunk.push_back(queue.front());
+                queue.pop_front();
+            }
+            if (ctx.telemetry)
+                ctx.telemetry->frontier_changed(-(long)take);
+            // Let another worker take the next chunk meanwhile
+            scheduled = !queue.empty();
+            if (scheduled)
+                workers->schedule(this);
+            turns++;
+        }
+
+        // Interns each new neighbor of the current task as soon as it is parsed, or stashes it
+        // if its level isn't final yet. Built once per turn, not once per request.
+        const Task* current = nullptr;
+        vector<string> stash;
+        function<void(const char*, size_t)> on_neighbor = [&](const char* name, size_t len) {
+            unique_lock<mutex> lock = lock_state();
+            if (current->level <= final_level)
+                intern(name, len, current->level + 1);
+            else
+                stash.emplace_back(name, len);
+        };
+        for (const Task& task : chunk) {
+            current = &task;
+            expand(curl, task, on_neighbor, stash);
+        }
+
+        unique_lock<mutex> lock = lock_state();
+        if (--turns == 0 && final_level >= depth)
+            cv.notify_all();
+    }
+
+    // Fetches one node and merges its neighbors, now or once its level is final. on_neighbor
+    // adds the names it can't merge yet to stash, which is left empty again.
+    void expand(CURL* curl, const Task& task, const function<void(const char*, size_t)>& on_neighbor, vector<string>& stash) {
+        try {
+            if (debug)
+                cout << "Processing node: " << *task.node << endl;
+
+            // Get neighbors through API call, interning each new one as soon as it is parsed
+            get_neighbors(ctx, curl, *task.node, task.level, on_neighbor);
+        } catch (const ParseException& e) {
+            cerr << "Error while fetching neighbors of: " << *task.node << endl;
+            throw e;
+        }
+
+        unique_lock<mutex> lock = lock_state();
+        if (task.level <= final_level) {
+            for (const string& name : stash)
+                intern(name.data(), name.size(), task.level + 1);
+            merged[task.level]++;
+            if (journal)
+                journal->expanded(task.id);
+            advance();
+        } else {
+            waiting[task.level].push_back({task.id, move(stash)});
+        }
+        stash.clear();
+    }
+
+    // Assigns a newly discovered name to a level and queues it (lock held)
+    void intern(const char* name, size_t len, int level) {
+        if (!visited.insert(name, len))
+            return;
+        uint32_t id = journal ? journal->discovered(name, len, level) : 0;
+        levels[level].emplace_back(name, len);
+        if (level < depth) {
+            queue.push_back({&levels[level].back(), level, id});
+            if (ctx.telemetry)
+                ctx.telemetry->frontier_changed(1);
+            if (workers && !scheduled) {
+                scheduled = true;
+                workers->schedule(this);
+            }
+        }
+    }
+
+    // Takes m, timing the wait if telemetry is on
+    unique_lock<mutex> lock_state() {
+        return ctx.telemetry ? ctx.telemetry->lock(m) : unique_lock<mutex>(m);
+    }
+
+    // Restores the state a previous run journaled: every discovered node keeps its level, and
+    // the nodes that were not fully merged are queued again
+    void recover() {
+        const vector<CrawlJournal::Entry>& entries = journal->recovered();
+        for (uint32_t id = 0; id < entries.size(); id++) {
+            const CrawlJournal::Entry& e = entries[id];
+            visited.insert(e.name);
+            levels[e.level].push_back(e.name);
+            const string* node = &levels[e.level].back();
+            if (e.expanded)
+                merged[e.level]++;
+            else if (e.level < depth)
+                queue.push_back({node, e.level, id});
+        }
+        if (ctx.telemetry)
+            ctx.telemetry->frontier_changed(queue.size());
+    }
+
+    // Sends a level that just became final to the output. The names of the deepest level are
+    // not queued, so they are handed over; the others stay until the level is merged (lock held).
+    void publish(int level) {
+        vector<string> names;
+        if (level == depth)
+            names.assign(make_move_iterator(levels[level].begin()), make_move_iterator(levels[level].end()));
+        else
+            names.assign(levels[level].begin(), levels[level].end());
+        size_t size = names.size();
+        out.write(level, move(names));
+        out.end_level(level, size);
+        if (level == depth)
+            deque<string>().swap(levels[level]);
+    }
+
+    // Moves final_level forward while the last final level is fully merged, merging the nodes
+    // that were waiting for their level to become final (lock held)
+    void advance() {
+        while (final_level < depth && merged[final_level] == levels[final_level].size()) {
+            deque<string>().swap(levels[final_level]);      // merged, so no task points into it
+            final_level++;
+            if (debug)
+                cout << "Level " << final_level << " is final with " << levels[final_level].size() << " nodes" << endl;
+            publish(final_level);
+            if (final_level < depth) {
+                for (const Stash& stash : waiting[final_level]) {
+                    for (const string& name : stash.names)
+                        intern(name.data(), name.size(), final_level + 1);
+                    merged[final_level]++;
+                    if (journal)
+                        journal->expanded(stash.id);
                 }
-                
-                // Process assigned nodes
-                for (int i = start_idx; i < end_idx; i++) {
-                    process_node(thread_curl, current_level[i], visited, next_level);
+                waiting[final_level].clear();
+            }
+        }
+        if (final_level >= depth)
+            cv.notify_all();
+    }
+
+    FetchContext& ctx;
+    int depth;
+    CrawlJournal* journal;
+    NodeWriter& out;
+    CrawlWorkers* workers = nullptr;
+    int num_workers = 1;
+
+    mutex m;                    // Protects everything below
+    condition_variable cv;      // signals run() that the crawl is over
+    bool scheduled = false;     // whether the workers have a turn of ours queued
+    int turns = 0;              // turns in progress
+    VisitedNames& visited;
+    vector<deque<string>> levels;               // deques, so that tasks can point into them
+    deque<Task> queue;
+    vector<size_t> merged;                      // nodes of each level whose neighbors are merged
+    vector<vector<Stash>> waiting;              // fetched nodes waiting for their level to be final
+    int final_level = 0;                        // deepest level whose membership is final
+};
+
+const size_t PipelinedBFS::MAX_CHUNK;
+
+// Shortest path between two nodes by bidirectional BFS. Each round expands a whole level of the
+// side with the smaller frontier, or of both sides while their frontiers together fit in the
+// request window, with all of the round's fetches in flight at once. A name discovered by one
+// side that the other side has already reached joins the two searches.
+//
+// Every meeting is caught the moment the second side discovers the node, so after a round that
+// expanded sides at depths da and db no path shorter than da + db + 1 can exist: a meeting of
+// exactly that length ends the search right away, without waiting for the rest of the round.
+class BidirectionalSearch : CrawlWorkers::Job {
+public:
+    BidirectionalSearch(FetchContext& ctx, const string& source, const string& target, int max_depth)
+        : ctx(ctx), max_depth(max_depth) {
+        const string* roots[2] = {&sides[0].visited.emplace(source, Visit{nullptr, 0}).first->first,
+                                  &sides[1].visited.emplace(target, Visit{nullptr, 0}).first->first};
+        for (int s = 0; s < 2; s++)
+            sides[s].frontier.push_back(roots[s]);
+        if (source == target) {
+            meeting = roots[0];
+            best = 0;
+        }
+    }
+
+    // Returns the path from source to target, or an empty one if there is none within max_depth.
+    // Fetches on the server's workers, or on a set of its own.
+    vector<string> run() {
+        if (ctx.workers)
+            return run(*ctx.workers);
+        CrawlWorkers own(ctx.pool, ctx.controller.max_window(), ctx.telemetry);
+        return run(own);
+    }
+
+    long expanded(int side) const { return sides[side].expanded; }
+
+private:
+    vector<string> run(CrawlWorkers& on) {
+        workers = &on;
+        const size_t window = ctx.controller.max_window();
+        while (!meeting && !sides[0].frontier.empty() && !sides[1].frontier.empty()) {
+            int reach = sides[0].depth + sides[1].depth;
+            if (reach >= max_depth)
+                break;
+            size_t f0 = sides[0].frontier.size(), f1 = sides[1].frontier.size();
+            if (f0 + f1 <= window && reach + 2 <= max_depth)
+                expand_round({0, 1});
+            else
+                expand_round({f0 <= f1 ? 0 : 1});
+        }
+
+        vector<string> path;
+        if (!meeting || best > max_depth)
+            return path;
+        for (const string* node = meeting; node; node = sides[0].visited.at(*node).parent)
+            path.push_back(*node);
+        reverse(path.begin(), path.end());
+        for (const string* node = sides[1].visited.at(*meeting).parent; node; node = sides[1].visited.at(*node).parent)
+            path.push_back(*node);
+        return path;
+    }
+
+    struct Visit {
+        const string* parent;   // the node it was discovered from, nullptr for the root
+        int depth;
+    };
+
+    struct Side {
+        unordered_map<string, Visit> visited;
+        vector<const string*> frontier;     // names point into visited
+        vector<const string*> next;
+        int depth = 0;
+        long expanded = 0;
+    };
+
+    struct Task {
+        int side;
+        const string* node;
+    };
+
+    void expand_round(const vector<int>& expanding) {
+        tasks.clear();
+        for (int s : expanding)
+            for (const string* node : sides[s].frontier)
+                tasks.push_back({s, node});
+        shortest_possible = sides[0].depth + sides[1].depth + 1;
+
+        {
+            unique_lock<mutex> lock(m);
+            next_task = 0;
+            if (!tasks.empty()) {
+                scheduled = true;
+                workers->schedule(this);
+            }
+            round_over.wait(lock, [&]() { return !scheduled && turns == 0; });
+        }
+
+        for (int s : expanding) {
+            Side& side = sides[s];
+            side.frontier.swap(side.next);
+            side.next.clear();
+            side.depth++;
+        }
+    }
+
+    void expand(CURL* curl, const Task& task) {
+        Side& own = sides[task.side];
+        Side& other = sides[1 - task.side];
+        try {
+            get_neighbors(ctx, curl, *task.node, own.depth, [&](const char* name, size_t len) {
+                lock_guard<mutex> lock(m);
+                auto inserted = own.visited.emplace(string(name, len), Visit{task.node, own.depth + 1});
+                if (!inserted.second)
+                    return;
+                const string* node = &inserted.first->first;
+                own.next.push_back(node);
+
+                auto hit = other.visited.find(*node);
+                if (hit == other.visited.end())
+                    return;
+                int length = own.depth + 1 + hit->second.depth;
+                if (length < best) {
+                    best = length;
+                    meeting = task.side == 0 ? node : &hit->first;
+                    if (length == shortest_possible)
+                        done = true;
                 }
-                
-                curl_easy_cleanup(thread_curl);
             });
+        } catch (const ParseException& e) {
+            cerr << "Error while fetching neighbors of: " << *task.node << endl;
+            throw e;
+        }
+        lock_guard<mutex> lock(m);
+        own.expanded++;
+    }
+
+    // A worker's turn: expands the next node of the round, unless the search is already done
+    void step(CURL* curl) override {
+        size_t t;
+        {
+            lock_guard<mutex> lock(m);
+            t = next_task++;
+            scheduled = !done && next_task < tasks.size();
+            if (scheduled)
+                workers->schedule(this);
+            turns++;
         }
-        
-        // Wait for all threads to finish
-        for (auto& t : threads) {
+        if (!done)
+            expand(curl, tasks[t]);
+        lock_guard<mutex> lock(m);
+        if (--turns == 0 && !scheduled)
+            round_over.notify_all();
+    }
+
+    FetchContext& ctx;
+    int max_depth;
+    CrawlWorkers* workers = nullptr;
+    vector<Task> tasks;                 // the nodes of the current round
+
+    mutex m;                            // Protects the sides, the meeting and the round's progress
+    condition_variable round_over;
+    size_t next_task = 0;
+    bool scheduled = false;             // whether the workers have a turn of ours queued
+    int turns = 0;                      // turns in progress
+    Side sides[2];                      // 0 searches from the source, 1 from the target
+    const string* meeting = nullptr;    // node where the searches joined, a key of sides[0].visited
+    int best = INT32_MAX;
+    int shortest_possible = 0;
+    atomic<bool> done{false};
+};
+
+// Limits of a best-first crawl; 0 means no limit
+struct CrawlBudget {
+    long requests = 0;      // nodes expanded
+    long ms = 0;            // wall time; requests already in flight are let finish
+};
+
+// Order in which a best-first crawl expands its frontier
+enum class CrawlPriority {
+    DEPTH,      // shallowest first: a BFS cut off wherever the budget runs out
+    DEGREE,     // most links from the nodes expanded so far first
+    SCORE       // highest user score first, then by degree
+};
+
+// Crawl that expands the most promising nodes first and stops when its budget is spent. The
+// frontier is a priority queue shared by the workers, so a request slot that frees up always
+// goes to the best node known at that moment, not to the next node of the level. A node's
+// degree estimate is the number of expanded nodes that list it; it grows while the node waits,
+// so an entry is pushed again on every change and outdated entries are skipped when popped.
+//
+// The output has every discovered node, at the shortest distance the crawl found for it (which
+// can be longer than its true distance, since not every node was expanded).
+class BestFirstCrawl {
+public:
+    BestFirstCrawl(FetchContext& ctx, const string& start, int depth, const CrawlBudget& budget,
+                   CrawlPriority priority, const unordered_map<string, double>* scores = nullptr)
+        : ctx(ctx), depth(depth), budget(budget), priority(priority), scores(scores),
+          deadline(chrono::steady_clock::now() + chrono::milliseconds(budget.ms)) {
+        discover(start.data(), start.size(), 0);
+    }
+
+    void run() {
+        vector<thread> workers;
+        num_workers = ctx.controller.max_window();
+        for (int i = 0; i < num_workers; i++)
+            workers.emplace_back(&BestFirstCrawl::worker, this);
+        for (auto& t : workers)
             t.join();
+    }
+
+    // Every discovered node, grouped by distance from the start in discovery order
+    vector<vector<string>> levels() const {
+        vector<vector<string>> result(depth + 1);
+        for (const string* name : order)
+            result[nodes.at(*name).depth].push_back(*name);
+        return result;
+    }
+
+    void print_summary(ostream& out) const {
+        static const char* const REASONS[] = {"frontier exhausted", "request budget", "time budget"};
+        out << "Best-first crawl: " << expansions << " nodes expanded, " << order.size() << " discovered, "
+            << frontier_size() << " left in the frontier, stopped by " << REASONS[stop_reason] << "\n";
+    }
+
+private:
+    struct Node {
+        int depth;
+        int degree = 0;             // expanded nodes listing this one
+        double score = 0;
+        bool expanded = false;      // taken by a worker
+        uint32_t id;                // discovery order, breaks ties first come first served
+    };
+
+    struct Entry {
+        double key;
+        double tie;
+        int depth;
+        uint32_t id;
+        int degree;                 // the node's degree and depth when pushed, to spot outdated entries
+        const string* name;
+
+        bool operator<(const Entry& other) const {
+            if (key != other.key)
+                return key < other.key;
+            if (tie != other.tie)
+                return tie < other.tie;
+            if (depth != other.depth)
+                return depth > other.depth;
+            return id > other.id;
+        }
+    };
+
+    enum StopReason { EXHAUSTED, REQUEST_BUDGET, TIME_BUDGET };
+
+    void worker() {
+        CURL* curl = ctx.pool.acquire();
+        if (!curl) {
+            cerr << "Failed to initialize CURL in thread" << endl;
+            return;
+        }
+
+        vector<string> names;
+        for (;;) {
+            const string* node;
+            int level;
+            {
+                unique_lock<mutex> lock(m);
+                // Budgets are checked at dispatch, so a spent budget only stops new requests. With a
+                // time budget, waiting workers wake up at the deadline to notice it has passed.
+                auto ready = [&]() { return (!spent() && pop_valid()) || in_flight == 0; };
+                if (budget.ms)
+                    cv.wait_until(lock, deadline, ready);
+                else
+                    cv.wait(lock, ready);
+                if (spent() || !pop_valid())
+                    break;
+                Entry best = frontier.top();
+                frontier.pop();
+                Node& n = nodes.at(*best.name);
+                n.expanded = true;
+                node = best.name;
+                level = n.depth;
+                expansions++;
+                in_flight++;
+            }
+
+            try {
+                get_neighbors(ctx, curl, *node, level, [&](const char* name, size_t len) {
+                    names.emplace_back(name, len);
+                });
+            } catch (const ParseException& e) {
+                cerr << "Error while fetching neighbors of: " << *node << endl;
+                throw e;
+            }
+
+            lock_guard<mutex> lock(m);
+            for (const string& name : names)
+                discover(name.data(), name.size(), level + 1);
+            names.clear();
+            in_flight--;
+            cv.notify_all();
+        }
+
+        {
+            lock_guard<mutex> lock(m);
+            cv.notify_all();
         }
+        ctx.pool.release(curl);
     }
-    
-    return levels;
+
+    // Records a link to a name, queuing it if it is new or its priority changed (lock held)
+    void discover(const char* name, size_t len, int level) {
+        auto inserted = nodes.emplace(string(name, len), Node());
+        Node& n = inserted.first->second;
+        const string* key = &inserted.first->first;
+        if (inserted.second) {
+            n.depth = level;
+            n.id = order.size();
+            order.push_back(key);
+            if (scores) {
+                auto s = scores->find(*key);
+                if (s != scores->end())
+                    n.score = s->second;
+            }
+        } else {
+            n.depth = min(n.depth, level);
+        }
+        if (level > 0)
+            n.degree++;
+        if (!n.expanded && n.depth < depth)
+            frontier.push(entry(key, n));
+    }
+
+    Entry entry(const string* name, const Node& n) const {
+        Entry e;
+        e.depth = n.depth;
+        e.id = n.id;
+        e.degree = n.degree;
+        e.name = name;
+        e.tie = 0;
+        switch (priority) {
+        case CrawlPriority::DEPTH:
+            e.key = -n.depth;
+            break;
+        case CrawlPriority::DEGREE:
+            e.key = n.degree;
+            break;
+        case CrawlPriority::SCORE:
+            e.key = n.score;
+            e.tie = n.degree;
+            break;
+        }
+        return e;
+    }
+
+    // Drops outdated entries off the top; returns whether a valid one is left (lock held)
+    bool pop_valid() {
+        while (!frontier.empty()) {
+            const Entry& top = frontier.top();
+            const Node& n = nodes.at(*top.name);
+            if (!n.expanded && top.degree == n.degree && top.depth == n.depth)
+                return true;
+            frontier.pop();
+        }
+        return false;
+    }
+
+    // Whether no more requests may start, noting why the first time (lock held)
+    bool spent() {
+        if (stop_reason == EXHAUSTED) {
+            if (budget.requests && expansions >= budget.requests)
+                stop_reason = REQUEST_BUDGET;
+            else if (budget.ms && chrono::steady_clock::now() >= deadline)
+                stop_reason = TIME_BUDGET;
+        }
+        return stop_reason != EXHAUSTED;
+    }
+
+    size_t frontier_size() const {
+        size_t n = 0;
+        for (const auto& node : nodes)
+            n += !node.second.expanded && node.second.depth < depth;
+        return n;
+    }
+
+    FetchContext& ctx;
+    const int depth;
+    const CrawlBudget budget;
+    const CrawlPriority priority;
+    const unordered_map<string, double>* scores;
+    const chrono::steady_clock::time_point deadline;
+    int num_workers = 1;
+
+    mutex m;                    // Protects everything below
+    condition_variable cv;
+    unordered_map<string, Node> nodes;
+    vector<const string*> order;            // keys of nodes in discovery order
+    priority_queue<Entry> frontier;
+    long expansions = 0;
+    int in_flight = 0;
+    StopReason stop_reason = EXHAUSTED;
+};
+
+// Reads "name<TAB>score" lines for --priority score
+unordered_map<string, double> read_scores(const string& path) {
+    ifstream in(path);
+    if (!in)
+        throw runtime_error("cannot read " + path);
+    unordered_map<string, double> scores;
+    string line;
+    while (getline(in, line)) {
+        size_t tab = line.rfind('\t');
+        if (tab != string::npos)
+            scores[line.substr(0, tab)] = atof(line.c_str() + tab + 1);
+    }
+    return scores;
+}
+
+// Parallel BFS implementation
+void parallel_bfs(FetchContext& ctx, VisitedNames& visited, NodeWriter& out, const string& start, int depth, CrawlJournal* journal) {
+    PipelinedBFS bfs(ctx, visited, out, start, depth, journal);
+    bfs.run();
+}
+
+// Degrees of separation: prints the shortest path from source to target, if it is at most
+// max_depth hops long
+void path_query(FetchContext& ctx, const string& source, const string& target, int max_depth, ostream& out) {
+    const auto start = chrono::steady_clock::now();
+    BidirectionalSearch search(ctx, source, target, max_depth);
+    vector<string> path = search.run();
+    const chrono::duration<double> elapsed_seconds = chrono::steady_clock::now() - start;
+
+    if (path.empty()) {
+        out << "No path within " << max_depth << " hops\n";
+    } else {
+        for (const auto& node : path)
+            out << "- " << node << "\n";
+        out << "Distance: " << path.size() - 1 << "\n";
+    }
+    out << "Nodes expanded: " << search.expanded(0) + search.expanded(1) << " (" << search.expanded(0)
+         << " from the source, " << search.expanded(1) << " from the target)\n";
+    out << "Time to crawl: " << elapsed_seconds.count() << "s\n";
+}
+
+// Long-running server mode. Queries share one connection pool, one concurrency window and one
+// neighbor cache, so connections stay warm and overlapping neighborhoods are fetched only once.
+// A query is a line of tab-separated fields:
+//     bfs <node> <depth>
+//     path <source> <target> <max depth>
+//     stats
+//     shutdown            (stops a --listen server)
+// Each answer is written as one block, framed by "# query <id>: ..." and "# done <id>: ..."
+// lines, so answers to concurrent queries do not interleave. A fixed set of max_queries threads
+// answers the queries, and all of them fetch through one set of crawl workers. Queries that find
+// every thread busy wait in a queue of at most max_queries; while it is full, the connections
+// are not read any further.
+class QueryServer {
+public:
+    QueryServer(ConnectionPool& pool, ConcurrencyController& controller, const RetryPolicy& policy,
+                const CrawlSnapshot* snapshot, int max_queries, CrawlTelemetry* telemetry = nullptr)
+        : pool(pool), controller(controller), policy(policy), snapshot(snapshot), telemetry(telemetry),
+          max_queries(max_queries), started(chrono::steady_clock::now()),
+          workers(pool, controller.max_window(), telemetry) {
+        for (int i = 0; i < max_queries; i++)
+            query_threads.emplace_back(&QueryServer::answer_queries, this);
+    }
+
+    // Called once nothing is served any more
+    ~QueryServer() {
+        {
+            lock_guard<mutex> lock(m);
+            closing = true;
+        }
+        query_ready.notify_all();
+        for (auto& t : query_threads)
+            t.join();
+    }
+
+    // Answers the queries read from in_fd on out_fd until in_fd is closed
+    void serve(int in_fd, int out_fd) {
+        Client client;
+        client.fd = out_fd;
+        string buffered, line;
+        while (!stopping && read_line(in_fd, buffered, line)) {
+            vector<string> fields;
+            stringstream split(line);
+            for (string field; getline(split, field, '\t');)
+                fields.push_back(field);
+            if (fields.empty() || fields[0].empty())
+                continue;
+            if (fields[0] == "stats") {
+                ostringstream out;
+                print_summary(out);
+                write_block(client, "# stats\n" + out.str());
+            } else if (fields[0] == "shutdown") {
+                stop();
+            } else {
+                unique_lock<mutex> lock(m);
+                queue_space.wait(lock, [&]() { return queued.size() < (size_t)max_queries; });
+                queued.push_back({move(fields), ++next_id, &client});
+                client.pending++;
+                query_ready.notify_one();
+            }
+        }
+        // The answers still to come go to client
+        unique_lock<mutex> lock(m);
+        answered.wait(lock, [&]() { return client.pending == 0; });
+    }
+
+    // Serves every connection to a Unix socket at path until a client sends "shutdown"
+    bool listen(const string& path) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof addr.sun_path) {
+            cerr << "Error: socket path too long: " << path << endl;
+            return false;
+        }
+        strcpy(addr.sun_path, path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str());
+        if (listen_fd < 0 || ::bind(listen_fd, (sockaddr*)&addr, sizeof addr) != 0 || ::listen(listen_fd, 64) != 0) {
+            cerr << "Error: cannot listen on " << path << endl;
+            return false;
+        }
+        cerr << "Listening on " << path << endl;
+
+        for (;;) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0)
+                break;      // shut down by stop()
+            lock_guard<mutex> lock(connections_m);
+            reap_connections();
+            open_connections.push_back(fd);
+            auto connection = connections.emplace(connections.end());
+            *connection = thread([this, fd, connection]() {
+                serve(fd, fd);
+                lock_guard<mutex> lock(connections_m);
+                open_connections.erase(find(open_connections.begin(), open_connections.end(), fd));
+                close(fd);
+                closed.push_back(connection);
+            });
+        }
+        for (auto& t : connections)
+            t.join();
+        close(listen_fd);
+        unlink(path.c_str());
+        return true;
+    }
+
+    void print_summary(ostream& out) const {
+        lock_guard<mutex> lock(m);
+        const chrono::duration<double> uptime = chrono::steady_clock::now() - started;
+        out << "Server: " << latencies.size() << " queries in " << uptime.count() << "s ("
+            << latencies.size() / uptime.count() << " queries/s), latency p50 " << percentile(latencies, 0.50)
+            << "s, p99 " << percentile(latencies, 0.99) << "s, " << fetches << " nodes fetched, "
+            << cache_hits << " from the cache\n";
+        cache.print_summary(out);
+    }
+
+private:
+    // Splits the next line off what has been read from fd; false at end of input
+    static bool read_line(int fd, string& buffered, string& line) {
+        for (;;) {
+            size_t end = buffered.find('\n');
+            if (end != string::npos) {
+                line = buffered.substr(0, end);
+                buffered.erase(0, end + 1);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                return true;
+            }
+            char chunk[4096];
+            ssize_t n = read(fd, chunk, sizeof chunk);
+            if (n <= 0) {
+                line.swap(buffered);
+                buffered.clear();
+                return !line.empty();
+            }
+            buffered.append(chunk, n);
+        }
+    }
+
+    // Reads the depth of a query; false unless all of text is an integer from 0 to MAX_QUERY_DEPTH
+    static bool parse_depth(const string& text, int& depth) {
+        char* end = nullptr;
+        errno = 0;
+        long value = strtol(text.c_str(), &end, 10);
+        if (text.empty() || *end != '\0' || errno == ERANGE || value < 0 || value > MAX_QUERY_DEPTH)
+            return false;
+        depth = (int)value;
+        return true;
+    }
+
+    // A client's end of the server
+    struct Client {
+        int fd = -1;
+        mutex out_m;                // Keeps answers whole
+        int pending = 0;            // queries read but not answered yet (guarded by QueryServer::m)
+    };
+
+    struct Query {
+        vector<string> fields;
+        long id;
+        Client* client;
+    };
+
+    static void write_block(Client& client, const string& block) {
+        lock_guard<mutex> lock(client.out_m);
+        for (size_t done = 0; done < block.size();) {
+            ssize_t n = write(client.fd, block.data() + done, block.size() - done);
+            if (n <= 0)
+                return;     // the client went away
+            done += n;
+        }
+    }
+
+    // Joins the threads of the connections that have closed since the last call (connections_m held)
+    void reap_connections() {
+        for (auto connection : closed) {
+            connection->join();
+            connections.erase(connection);
+        }
+        closed.clear();
+    }
+
+    // Wakes up accept() and every connection waiting for its next query
+    void stop() {
+        stopping = true;
+        if (listen_fd >= 0)
+            shutdown(listen_fd, SHUT_RDWR);
+        lock_guard<mutex> lock(connections_m);
+        for (int fd : open_connections)
+            shutdown(fd, SHUT_RD);
+    }
+
+    // Body of the query threads
+    void answer_queries() {
+        unique_lock<mutex> lock(m);
+        for (;;) {
+            query_ready.wait(lock, [&]() { return !queued.empty() || closing; });
+            if (queued.empty())
+                return;
+            Query query = move(queued.front());
+            queued.pop_front();
+            queue_space.notify_one();
+            lock.unlock();
+            answer(query.fields, query.id, *query.client);
+            lock.lock();
+            if (--query.client->pending == 0)
+                answered.notify_all();
+        }
+    }
+
+    void answer(const vector<string>& fields, long id, Client& client) {
+        FetchContext ctx(pool, controller, policy);
+        ctx.snapshot = snapshot;
+        ctx.cache = &cache;
+        ctx.workers = &workers;
+        ctx.telemetry = telemetry;
+        ostringstream body;
+        long nodes = 0;
+        const auto start = chrono::steady_clock::now();
+        try {
+            int depth = 0;
+            if ((fields[0] == "bfs" && fields.size() == 3 && !parse_depth(fields[2], depth)) ||
+                (fields[0] == "path" && fields.size() == 4 && !parse_depth(fields[3], depth))) {
+                body << "Error: depth must be an integer from 0 to " << MAX_QUERY_DEPTH << "\n";
+            } else if (fields[0] == "bfs" && fields.size() == 3) {
+                string text;
+                NodeWriter out(&text, OutputFormat::TEXT);
+                VisitedNames visited;
+                PipelinedBFS bfs(ctx, visited, out, fields[1], depth);
+                bfs.run();
+                out.close();
+                body << text;
+                nodes = visited.size();
+            } else if (fields[0] == "path" && fields.size() == 4) {
+                path_query(ctx, fields[1], fields[2], depth, body);
+            } else {
+                body << "Error: expected \"bfs<TAB>node<TAB>depth\" or \"path<TAB>source<TAB>target<TAB>max depth\"\n";
+            }
+        } catch (const exception& e) {
+            body << "Error: " << e.what() << "\n";
+        }
+        const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        {
+            lock_guard<mutex> lock(m);
+            latencies.push_back(elapsed.count());
+            fetches += ctx.fetches;
+            cache_hits += ctx.cache_hits;
+        }
+
+        string query = fields[0];
+        for (size_t i = 1; i < fields.size(); i++)
+            query += " " + fields[i];
+        ostringstream done;
+        done << "# done " << id << ": " << nodes << " nodes in " << elapsed.count() << "s, " << ctx.fetches
+             << " fetched, " << ctx.cache_hits << " from the cache\n";
+        write_block(client, "# query " + to_string(id) + ": " + query + "\n" + body.str() + done.str());
+    }
+
+    // Deepest query accepted: the whole graph is within a few hops, and every level costs memory
+    static const int MAX_QUERY_DEPTH = 32;
+
+    ConnectionPool& pool;
+    ConcurrencyController& controller;
+    const RetryPolicy policy;
+    const CrawlSnapshot* snapshot;
+    CrawlTelemetry* telemetry;
+    const int max_queries;
+    const chrono::steady_clock::time_point started;
+    NeighborCache cache;
+    CrawlWorkers workers;
+    vector<thread> query_threads;
+    atomic<bool> stopping{false};
+    int listen_fd = -1;
+    mutex connections_m;            // Protects the three below
+    vector<int> open_connections;
+    list<thread> connections;
+    vector<list<thread>::iterator> closed;      // connections whose thread is done, not joined yet
+
+    mutable mutex m;                // Protects everything below
+    condition_variable query_ready, queue_space, answered;
+    deque<Query> queued;
+    long next_id = 0;
+    bool closing = false;
+    vector<double> latencies;
+    long fetches = 0, cache_hits = 0;
+};
+
+// Stops the telemetry and writes it to path as JSON (only shown live if path is empty)
+void write_telemetry(CrawlTelemetry* telemetry, const string& path) {
+    if (!telemetry)
+        return;
+    telemetry->stop();
+    if (!path.empty()) {
+        ofstream out(path);
+        telemetry->write_json(out);
+        if (out)
+            cout << "Telemetry written to " << path << "\n";
+        else
+            cerr << "Error: could not write " << path << endl;
+    }
+    delete telemetry;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <node_name> <depth>\n";
+    // A server takes its start nodes and depths from its queries
+    const bool server_mode = argc > 1 && (string(argv[1]) == "--serve" || string(argv[1]) == "--listen");
+    if (argc < 3 && !server_mode) {
+        cerr << "Usage: " << argv[0] << " <node_name> <depth> [--http2] [--max-concurrency N]"
+             << " [--retries N] [--deadline-ms MS] [--hedge] [--snapshot FILE] [--export FILE] [--path TARGET]"
+             << " [--checkpoint FILE [--resume]] [--visited-budget MB] [--spill-dir DIR]"
+             << " [--output FILE] [--output-format text|jsonl|binary] [--telemetry FILE] [--telemetry-live SECONDS]"
+             << " [--budget-requests N] [--budget-ms MS] [--priority depth|degree|score] [--scores FILE]\n"
+             << "       " << argv[0] << " --serve|--listen SOCKET [--max-queries N] [options]\n";
         return 1;
     }
 
-    string start_node = argv[1];    // example "Tom%20Hanks"
-    int depth;
-    try {
-        depth = stoi(argv[2]);
-    } catch (const exception& e) {
-        cerr << "Error: Depth must be an integer.\n";
+    string start_node;
+    int depth = 0;
+    int first_option = 1;
+    if (!server_mode) {
+        start_node = argv[1];       // example "Tom%20Hanks"
+        try {
+            depth = stoi(argv[2]);
+        } catch (const exception& e) {
+            cerr << "Error: Depth must be an integer.\n";
+            return 1;
+        }
+        if (depth < 0) {
+            cerr << "Error: Depth must be a non-negative integer.\n";
+            return 1;
+        }
+        first_option = 3;
+    }
+
+    bool http2 = false;
+    int max_concurrency = DEFAULT_MAX_CONCURRENCY;
+    RetryPolicy policy;
+    string snapshot_path, export_path, target, checkpoint_path;
+    bool resume = false;
+    size_t visited_budget = 0;
+    string spill_dir = "/tmp";
+    string output_path;
+    OutputFormat output_format = OutputFormat::TEXT;
+    bool serve = false;
+    string listen_path;
+    int max_queries = 4;
+    string telemetry_path;
+    double telemetry_live = 0;      // seconds between live lines, 0 for none
+    CrawlBudget budget;
+    bool best_first = false;        // any budget or priority switches to the best-first crawl
+    CrawlPriority priority = CrawlPriority::DEGREE;
+    string scores_path;
+    for (int i = first_option; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--http2") {
+            http2 = true;
+        } else if (arg == "--max-concurrency" && i + 1 < argc) {
+            max_concurrency = max(1, atoi(argv[++i]));
+        } else if (arg == "--retries" && i + 1 < argc) {
+            policy.max_attempts = 1 + max(0, atoi(argv[++i]));
+        } else if (arg == "--deadline-ms" && i + 1 < argc) {
+            policy.deadline_ms = max(1L, atol(argv[++i]));
+        } else if (arg == "--hedge") {
+            policy.hedge = true;
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (arg == "--export" && i + 1 < argc) {
+            export_path = argv[++i];
+        } else if (arg == "--path" && i + 1 < argc) {
+            target = argv[++i];     // depth becomes the longest path searched for
+        } else if (arg == "--checkpoint" && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if (arg == "--visited-budget" && i + 1 < argc) {
+            visited_budget = max(1L, atol(argv[++i])) << 20;
+        } else if (arg == "--spill-dir" && i + 1 < argc) {
+            spill_dir = argv[++i];
+        } else if (arg == "--output" && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (arg == "--output-format" && i + 1 < argc && parse_output_format(argv[i + 1], output_format)) {
+            i++;
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--listen" && i + 1 < argc) {
+            listen_path = argv[++i];
+        } else if (arg == "--max-queries" && i + 1 < argc) {
+            max_queries = max(1, atoi(argv[++i]));
+        } else if (arg == "--telemetry" && i + 1 < argc) {
+            telemetry_path = argv[++i];
+        } else if (arg == "--telemetry-live" && i + 1 < argc) {
+            telemetry_live = max(0.1, atof(argv[++i]));
+        } else if (arg == "--budget-requests" && i + 1 < argc) {
+            budget.requests = max(1L, atol(argv[++i]));
+            best_first = true;
+        } else if (arg == "--budget-ms" && i + 1 < argc) {
+            budget.ms = max(1L, atol(argv[++i]));
+            best_first = true;
+        } else if (arg == "--priority" && i + 1 < argc) {
+            string name = argv[++i];
+            if (name == "depth") {
+                priority = CrawlPriority::DEPTH;
+            } else if (name == "degree") {
+                priority = CrawlPriority::DEGREE;
+            } else if (name == "score") {
+                priority = CrawlPriority::SCORE;
+            } else {
+                cerr << "Error: Unknown priority " << name << "\n";
+                return 1;
+            }
+            best_first = true;
+        } else if (arg == "--scores" && i + 1 < argc) {
+            scores_path = argv[++i];
+            priority = CrawlPriority::SCORE;
+            best_first = true;
+        } else {
+            cerr << "Error: Unknown option " << arg << "\n";
+            return 1;
+        }
+    }
+
+    if (resume && checkpoint_path.empty()) {
+        cerr << "Error: --resume needs --checkpoint FILE\n";
         return 1;
     }
+    if (best_first && (!checkpoint_path.empty() || server_mode)) {
+        cerr << "Error: a budgeted crawl can't be checkpointed or served\n";
+        return 1;
+    }
+    unordered_map<string, double> scores;
+    if (!scores_path.empty()) {
+        try {
+            scores = read_scores(scores_path);
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+    }
 
-    CURL* curl = curl_easy_init();
-    if (!curl) {
+    if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
         cerr << "Failed to initialize CURL" << endl;
         return -1;
     }
+    ConnectionPool* pool = new ConnectionPool(SERVICE_URL, http2);
+    ConcurrencyController controller(INITIAL_CONCURRENCY, max_concurrency, debug);
+    FetchContext ctx(*pool, controller, policy);
 
-    const auto start = chrono::steady_clock::now();
-    
-    auto levels = parallel_bfs(curl, start_node, depth);
-    
-    const auto finish = chrono::steady_clock::now();
-    const chrono::duration<double> elapsed_seconds = finish - start;
-    
-    for (const auto& level : levels) {
-        for (const auto& node : level) {
-            cout << "- " << node << "\n";
+    // A snapshot answers the whole query when it has expanded every node the BFS needs; otherwise
+    // it serves what it has and the crawl fetches the rest
+    CrawlSnapshot* snapshot = nullptr;
+    if (!snapshot_path.empty()) {
+        try {
+            snapshot = new CrawlSnapshot(snapshot_path);
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+        ctx.snapshot = snapshot;
+    }
+    SnapshotBuilder recorder;
+    if (!export_path.empty())
+        ctx.recorder = &recorder;
+
+    // Sampled once a second for the JSON timeline, or as often as the live line asks
+    CrawlTelemetry* telemetry = nullptr;
+    if (!telemetry_path.empty() || telemetry_live > 0) {
+        telemetry = new CrawlTelemetry;
+        telemetry->on_sample = [&controller](CrawlTelemetry::Sample& s) {
+            s.in_flight = controller.requests_in_flight();
+            s.window = controller.window();
+        };
+        telemetry->start(telemetry_live > 0 ? telemetry_live : 1.0, telemetry_live > 0);
+        ctx.telemetry = telemetry;
+    }
+
+    if (serve || !listen_path.empty()) {
+        {
+            // Its threads hold handles of the pool, so it goes first
+            QueryServer server(*pool, controller, policy, snapshot, max_queries, telemetry);
+            if (!listen_path.empty()) {
+                if (!server.listen(listen_path))
+                    return 1;
+            } else {
+                server.serve(STDIN_FILENO, STDOUT_FILENO);
+            }
+            server.print_summary(cout);
+        }
+        pool->print_summary(cout);
+        controller.print_summary(cout);
+        write_telemetry(telemetry, telemetry_path);
+        delete snapshot;
+        delete pool;
+        curl_global_cleanup();
+        return 0;
+    }
+
+    vector<vector<string>> levels;
+    DirectionBfsStats bfs_stats;
+    bool local = false;
+    VisitedNames* visited = nullptr;
+    ostringstream best_first_summary;
+    if (!target.empty()) {
+        path_query(ctx, start_node, target, depth, cout);
+    } else {
+        // Nodes are written by a thread of their own as their levels become final
+        NodeWriter* out;
+        cout.flush();
+        try {
+            out = new NodeWriter(output_path, output_format);
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
+
+        const auto start = chrono::steady_clock::now();
+
+        local = snapshot && export_path.empty() && checkpoint_path.empty() && !best_first
+                && snapshot_bfs(*snapshot, start_node, depth, levels, &bfs_stats);
+        if (best_first) {
+            BestFirstCrawl crawl(ctx, start_node, depth, budget, priority, &scores);
+            crawl.run();
+            levels = crawl.levels();
+            for (size_t level = 0; level < levels.size(); level++) {
+                size_t size = levels[level].size();
+                out->write(level, move(levels[level]));
+                out->end_level(level, size);
+            }
+            crawl.print_summary(best_first_summary);
+        } else if (local) {
+            for (size_t level = 0; level < levels.size(); level++) {
+                size_t size = levels[level].size();
+                out->write(level, move(levels[level]));
+                out->end_level(level, size);
+            }
+        } else {
+            // The journal lets a crawl that dies half-way continue with --resume
+            CrawlJournal* journal = nullptr;
+            if (!checkpoint_path.empty()) {
+                try {
+                    journal = new CrawlJournal(checkpoint_path, start_node, depth, resume);
+                } catch (const runtime_error& e) {
+                    cerr << "Error: " << e.what() << endl;
+                    return 1;
+                }
+                if (resume)
+                    cerr << "Resuming with " << journal->recovered().size() << " nodes from " << checkpoint_path << endl;
+            }
+            try {
+                visited = new VisitedNames(visited_budget, spill_dir);
+            } catch (const runtime_error& e) {
+                cerr << "Error: " << e.what() << endl;
+                return 1;
+            }
+            parallel_bfs(ctx, *visited, *out, start_node, depth, journal);
+            delete journal;
+        }
+
+        const auto finish = chrono::steady_clock::now();
+        const chrono::duration<double> elapsed_seconds = finish - start;
+
+        out->close();
+        if (!out->ok())
+            cerr << "Error: could not write the output" << endl;
+        cout << "Time to crawl: " << elapsed_seconds.count() << "s\n";
+        out->print_summary(cout);
+        delete out;
+    }
+    pool->print_summary(cout);
+    controller.print_summary(cout);
+    ctx.stats.print_summary(cout);
+    cout << best_first_summary.str();
+    if (visited)
+        visited->print_summary(cout);
+    if (snapshot) {
+        if (local) {
+            cout << "Snapshot: answered locally (" << snapshot->num_nodes() << " nodes, " << snapshot->num_edges() << " edges)\n";
+            cout << "Direction-optimizing BFS: steps " << bfs_stats.steps << ", " << bfs_stats.edges_examined
+                 << " edges examined in " << bfs_stats.seconds * 1000 << "ms ("
+                 << (bfs_stats.seconds > 0 ? bfs_stats.edges_examined / bfs_stats.seconds / 1e6 : 0) << " M edges/s)\n";
+        } else {
+            cout << "Snapshot: " << ctx.snapshot_hits << " nodes expanded locally, the rest fetched\n";
+        }
+    }
+
+    if (!export_path.empty()) {
+        try {
+            recorder.write(export_path);
+            cout << "Exported " << recorder.expanded_count() << " expanded nodes to " << export_path << "\n";
+        } catch (const runtime_error& e) {
+            cerr << "Error: " << e.what() << endl;
         }
-        cout << "Level size: " << level.size() << "\n";
     }
     
-    cout << "Time to crawl: " << elapsed_seconds.count() << "s\n";
-    
-    curl_easy_cleanup(curl);
+    write_telemetry(telemetry, telemetry_path);
+
+    delete visited;
+    delete snapshot;
+    delete pool;
+    curl_global_cleanup();
     
     return 0;
 }
\ No newline at end of file
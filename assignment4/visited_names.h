@@ -0,0 +1,410 @@
+#ifndef VISITED_NAMES_H
+#define VISITED_NAMES_H
+
+// The set of node names a crawl has already seen, optionally kept within a fixed RAM budget.
+//
+// Without a budget this is an unordered_set<string>. With one, the names live in spill files on
+// disk and RAM holds a split-block Bloom filter in front of them. Each name sets one bit in each
+// of the eight words of a single 64-byte block, so a lookup touches one cache line. A Bloom
+// negative is always right and costs no I/O. Only a positive is checked against the exact set,
+// since it can be a false one.
+//
+// The exact set is a small LSM tree. New names collect in a RAM buffer. A full buffer is
+// appended to a names log and leaves behind a run of (hash, log offset) entries sorted by hash.
+// Runs of similar size are merged, so there are only O(log n) of them. RAM keeps the first hash
+// of every 4 KB block of a run, so probing a run takes one read of one block. A matching hash is
+// confirmed by comparing the name from the log, so answers are exact: a name is never reported
+// as seen when it was not, and never as new twice.
+//
+// Not thread-safe; callers serialize access. The one exception is may_contain(), a read of the
+// Bloom filter that may run alongside an insert.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <unistd.h>
+
+class VisitedNames {
+public:
+    // budget_bytes == 0 keeps every name in RAM. Otherwise the Bloom filter and the buffer of
+    // new names share the budget, and the spill files are unlinked temporaries in spill_dir.
+    // Throws std::runtime_error if they can't be created.
+    explicit VisitedNames(size_t budget_bytes = 0, const std::string& spill_dir = "/tmp")
+        : budget(budget_bytes), dir(spill_dir) {
+        if (!budget)
+            return;
+        num_blocks = std::max<uint64_t>(1, budget / 4 * 3 / sizeof(Block));
+        void* memory = nullptr;
+        if (posix_memalign(&memory, sizeof(Block), num_blocks * sizeof(Block)) != 0)
+            throw std::runtime_error("cannot allocate the Bloom filter");
+        blocks = static_cast<Block*>(memory);
+        for (uint64_t b = 0; b < num_blocks; b++)
+            for (int i = 0; i < 8; i++)
+                blocks[b].words[i].store(0, std::memory_order_relaxed);
+        buffer_limit = budget - num_blocks * sizeof(Block);
+        log_fd = make_spill_file();
+    }
+
+    ~VisitedNames() {
+        free(blocks);
+        if (log_fd >= 0)
+            close(log_fd);
+        for (const Run& run : runs)
+            close(run.fd);
+    }
+
+    VisitedNames(const VisitedNames&) = delete;
+    VisitedNames& operator=(const VisitedNames&) = delete;
+
+    // Adds a name; returns true if it was not in the set yet
+    bool insert(const char* name, size_t len) {
+        return insert(name, len, budget ? hash_name(name, len) : 0);
+    }
+
+    // The same with the name's hash(), which a caller can compute before taking its lock
+    bool insert(const char* name, size_t len, uint64_t h) {
+        const auto started = std::chrono::steady_clock::now();
+        bool inserted = budget ? insert_bounded(name, len, h) : insert_exact(name, len);
+        if (inserted) {
+            count++;
+            if (!budget)
+                exact_bytes += exact_entry_bytes(len);
+        }
+        lookups++;
+        lookup_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+        return inserted;
+    }
+
+    bool insert(const std::string& name) { return insert(name.data(), name.size()); }
+
+    static uint64_t hash(const char* name, size_t len) { return hash_name(name, len); }
+
+    // Bounded sets only: false if a name with hash h was not in the set when the filter was read.
+    // Takes no lock and may run while another thread inserts; true proves nothing.
+    bool may_contain(uint64_t h) const {
+        const Block& block = blocks[((h >> 32) * num_blocks) >> 32];
+        const uint32_t key = static_cast<uint32_t>(h);
+        for (int i = 0; i < 8; i++)
+            if (!(block.words[i].load(std::memory_order_relaxed) & bloom_bit(key, i)))
+                return false;
+        return true;
+    }
+
+    uint64_t size() const { return count; }
+
+    // RAM held by the set: the Bloom filter, the buffer and the run indexes when bounded, an
+    // estimate of the hash table's nodes, buckets and string buffers otherwise
+    size_t memory_bytes() const {
+        if (!budget)
+            return exact_bytes + exact.bucket_count() * sizeof(void*);
+        size_t index_bytes = 0;
+        for (const Run& run : runs)
+            index_bytes += run.index.capacity() * sizeof(uint64_t);
+        return num_blocks * sizeof(Block) + buffer_bytes + index_bytes;
+    }
+
+    void print_summary(std::ostream& out) const {
+        const double mb = 1024.0 * 1024.0;
+        const std::ios::fmtflags flags = out.flags();
+        const std::streamsize precision = out.precision();
+        out << std::fixed << std::setprecision(2);
+        out << "Visited set: " << count << " names in " << memory_bytes() / mb << " MB of RAM ("
+            << (count ? memory_bytes() / double(count) : 0.0) << " B/name), "
+            << (lookups ? lookup_ns / 1000.0 / lookups : 0.0) << " us per lookup over " << lookups << " lookups";
+        if (budget) {
+            out << "\n  bounded to " << budget / mb << " MB: Bloom filter " << num_blocks * sizeof(Block) / mb
+                << " MB, " << bloom_positives << " positives (" << false_positives << " false), "
+                << buffer_hits << " answered from the buffer, " << disk_probes << " from disk with "
+                << block_reads << " block and " << name_reads << " name reads\n"
+                << "  spilled " << (log_bytes + run_entries * sizeof(Entry)) / mb << " MB in " << flushes
+                << " flushes, " << runs.size() << " runs after " << merges << " merges";
+        }
+        out << "\n";
+        out.flags(flags);
+        out.precision(precision);
+    }
+
+private:
+    struct Block {
+        std::atomic<uint64_t> words[8];     // atomic only for may_contain(); inserts are serialized
+    };
+
+    struct Entry {
+        uint64_t hash;
+        uint64_t offset;    // of the name's record in the log: a uint32_t length, then the bytes
+    };
+
+    // A sorted run of entries in its own file
+    struct Run {
+        int fd;
+        uint64_t entries;
+        std::vector<uint64_t> index;    // first hash of every block
+    };
+
+    static const size_t BLOCK_ENTRIES = 4096 / sizeof(Entry);
+    static const size_t IO_ENTRIES = 65536 / sizeof(Entry);     // buffered sequential reads and writes
+
+    // FNV-1a with a splitmix64 finalizer, so the high bits that pick the block are well mixed
+    static uint64_t hash_name(const char* name, size_t len) {
+        uint64_t h = 14695981039346656037ULL;
+        for (size_t i = 0; i < len; i++) {
+            h ^= static_cast<unsigned char>(name[i]);
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+
+    // libstdc++ node (next pointer, string, cached hash) in a 64-byte malloc chunk, plus the
+    // string's own chunk once it outgrows the small-string buffer
+    static size_t exact_entry_bytes(size_t len) {
+        return 64 + (len > 15 ? (len + 1 + 8 + 15) / 16 * 16 : 0);
+    }
+
+    static uint64_t bloom_bit(uint32_t key, int word) {
+        static const uint32_t SALT[8] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                         0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+        return uint64_t(1) << ((key * SALT[word]) >> 26);
+    }
+
+    // Sets the name's bits; returns true if they were all set already
+    bool bloom_add(uint64_t h) {
+        Block& block = blocks[((h >> 32) * num_blocks) >> 32];
+        const uint32_t key = static_cast<uint32_t>(h);
+        bool present = true;
+        for (int i = 0; i < 8; i++) {
+            const uint64_t bit = bloom_bit(key, i);
+            const uint64_t word = block.words[i].load(std::memory_order_relaxed);
+            if (!(word & bit)) {
+                present = false;
+                block.words[i].store(word | bit, std::memory_order_relaxed);
+            }
+        }
+        return present;
+    }
+
+    // emplace() would build a node before finding the name is there, so look it up first
+    bool insert_exact(const char* name, size_t len) {
+        probe.assign(name, len);
+        if (exact.count(probe))
+            return false;
+        exact.insert(probe);
+        return true;
+    }
+
+    bool insert_bounded(const char* name, size_t len, uint64_t h) {
+        if (bloom_add(h)) {
+            bloom_positives++;
+            if (buffer.count(std::string(name, len))) {
+                buffer_hits++;
+                return false;
+            }
+            disk_probes++;
+            for (const Run& run : runs)
+                if (run_contains(run, h, name, len))
+                    return false;
+            false_positives++;
+        }
+        buffer.emplace(name, len);
+        buffer_bytes += exact_entry_bytes(len);
+        if (buffer_bytes >= buffer_limit)
+            flush();
+        return true;
+    }
+
+    int make_spill_file() const {
+        std::string path = dir + "/visited-XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(name.data());
+        if (fd < 0)
+            throw std::runtime_error("cannot create a spill file in " + dir);
+        unlink(name.data());    // gone with the descriptor, even after a crash
+        return fd;
+    }
+
+    static void write_at(int fd, const void* data, size_t bytes, uint64_t offset) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t n = pwrite(fd, p, bytes, offset);
+            if (n <= 0)
+                throw std::runtime_error("cannot write to a visited-set spill file");
+            p += n;
+            bytes -= n;
+            offset += n;
+        }
+    }
+
+    static size_t read_at(int fd, void* data, size_t bytes, uint64_t offset) {
+        char* p = static_cast<char*>(data);
+        size_t total = 0;
+        while (total < bytes) {
+            ssize_t n = pread(fd, p + total, bytes - total, offset + total);
+            if (n < 0)
+                throw std::runtime_error("cannot read a visited-set spill file");
+            if (n == 0)
+                break;
+            total += n;
+        }
+        return total;
+    }
+
+    // Appends entries, already sorted, to a run being written
+    static void append(Run& run, const Entry* entries, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            if ((run.entries + i) % BLOCK_ENTRIES == 0)
+                run.index.push_back(entries[i].hash);
+        write_at(run.fd, entries, n * sizeof(Entry), run.entries * sizeof(Entry));
+        run.entries += n;
+    }
+
+    // Writes the buffered names to the log and turns them into a new run
+    void flush() {
+        std::vector<Entry> entries;
+        entries.reserve(buffer.size());
+        std::string records;
+        for (const std::string& name : buffer) {
+            entries.push_back({hash_name(name.data(), name.size()), log_bytes + records.size()});
+            uint32_t len = name.size();
+            records.append(reinterpret_cast<const char*>(&len), sizeof len);
+            records += name;
+        }
+        write_at(log_fd, records.data(), records.size(), log_bytes);
+        log_bytes += records.size();
+        buffer.clear();
+        buffer_bytes = 0;
+
+        std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.hash < b.hash; });
+        Run run = {make_spill_file(), 0, std::vector<uint64_t>()};
+        append(run, entries.data(), entries.size());
+        run.index.shrink_to_fit();
+        runs.push_back(run);
+        run_entries += run.entries;
+        flushes++;
+
+        while (runs.size() >= 2 && runs[runs.size() - 2].entries <= 2 * runs.back().entries) {
+            Run merged = merge(runs[runs.size() - 2], runs.back());
+            runs.pop_back();
+            runs.back() = merged;
+        }
+    }
+
+    // Sequential reader over a run
+    struct RunCursor {
+        const Run& run;
+        std::vector<Entry> chunk;
+        uint64_t next = 0;      // entry of the run at chunk[pos]
+        size_t pos = 0;
+
+        explicit RunCursor(const Run& run) : run(run) { fill(); }
+
+        bool done() const { return next >= run.entries; }
+        const Entry& peek() const { return chunk[pos]; }
+
+        void pop() {
+            next++;
+            if (++pos == chunk.size())
+                fill();
+        }
+
+        void fill() {
+            chunk.resize(std::min<uint64_t>(IO_ENTRIES, run.entries - next));
+            read_at(run.fd, chunk.data(), chunk.size() * sizeof(Entry), next * sizeof(Entry));
+            pos = 0;
+        }
+    };
+
+    // Merges two runs into a new one and closes them; only the I/O buffers are held in RAM
+    Run merge(const Run& a, const Run& b) {
+        Run out = {make_spill_file(), 0, std::vector<uint64_t>()};
+        RunCursor x(a), y(b);
+        std::vector<Entry> pending;
+        pending.reserve(IO_ENTRIES);
+        while (!x.done() || !y.done()) {
+            RunCursor& from = y.done() || (!x.done() && x.peek().hash <= y.peek().hash) ? x : y;
+            pending.push_back(from.peek());
+            from.pop();
+            if (pending.size() == IO_ENTRIES) {
+                append(out, pending.data(), pending.size());
+                pending.clear();
+            }
+        }
+        append(out, pending.data(), pending.size());
+        out.index.shrink_to_fit();
+        close(a.fd);
+        close(b.fd);
+        merges++;
+        return out;
+    }
+
+    // Looks the name up in one run: one block read per candidate block, one name read per
+    // matching hash
+    bool run_contains(const Run& run, uint64_t h, const char* name, size_t len) {
+        size_t b = std::lower_bound(run.index.begin(), run.index.end(), h) - run.index.begin();
+        if (b > 0)
+            b--;    // equal hashes may start at the end of the previous block
+        Entry block[BLOCK_ENTRIES];
+        for (; b < run.index.size() && run.index[b] <= h; b++) {
+            const uint64_t first = b * BLOCK_ENTRIES;
+            const size_t n = std::min<uint64_t>(BLOCK_ENTRIES, run.entries - first);
+            read_at(run.fd, block, n * sizeof(Entry), first * sizeof(Entry));
+            block_reads++;
+            for (size_t i = 0; i < n && block[i].hash <= h; i++)
+                if (block[i].hash == h && name_matches(block[i].offset, name, len))
+                    return true;
+        }
+        return false;
+    }
+
+    bool name_matches(uint64_t offset, const char* name, size_t len) {
+        std::vector<char> record(sizeof(uint32_t) + len);
+        name_reads++;
+        if (read_at(log_fd, record.data(), record.size(), offset) != record.size())
+            return false;
+        uint32_t stored;
+        memcpy(&stored, record.data(), sizeof stored);
+        return stored == len && memcmp(record.data() + sizeof stored, name, len) == 0;
+    }
+
+    const size_t budget;
+    const std::string dir;
+    uint64_t count = 0;
+    uint64_t lookups = 0;
+    uint64_t lookup_ns = 0;
+
+    // Unbounded
+    std::unordered_set<std::string> exact;
+    size_t exact_bytes = 0;
+    std::string probe;          // reused lookup key, so a name already seen costs no allocation
+
+    // Bounded
+    Block* blocks = nullptr;
+    uint64_t num_blocks = 0;
+    std::unordered_set<std::string> buffer;     // names not yet spilled
+    size_t buffer_bytes = 0;
+    size_t buffer_limit = 0;
+    int log_fd = -1;
+    uint64_t log_bytes = 0;
+    std::vector<Run> runs;
+    uint64_t run_entries = 0;                   // entries written by flushes
+    uint64_t bloom_positives = 0, false_positives = 0, buffer_hits = 0, disk_probes = 0;
+    uint64_t block_reads = 0, name_reads = 0, flushes = 0, merges = 0;
+};
+
+const size_t VisitedNames::BLOCK_ENTRIES;
+const size_t VisitedNames::IO_ENTRIES;
+
+#endif
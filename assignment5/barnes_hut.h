@@ -0,0 +1,251 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+// Barnes-Hut force solver: O(n log n) per step instead of the all-pairs O(n^2) loop.
+//
+// Every step rebuilds the octree from scratch. Particles get a 63-bit Morton code (21 bits per
+// axis in the bounding cube) and are sorted by it, so every octree cell is a contiguous range
+// of the sorted particles and its eight children are found by binary search. The tree is laid
+// out in pre-order, each node storing the size of its subtree: the walk for a particle either
+// opens a node (next node) or uses it whole (skip the subtree), with no stack and no pointers.
+// Subtrees of large cells are built as OpenMP tasks into their own arrays, which are simply
+// concatenated because a pre-order array with relative skips can be moved as is.
+//
+// A cell is used whole when size / distance < theta, distance being measured to its center of
+// mass, and the particle is not inside it; theta = 0 degenerates to the exact all-pairs sum.
+// Without the second test, a theta above 1/sqrt(3) could accept the particle's own cell, whose
+// center of mass may be farther than size / theta, and the particle would attract itself.
+// Useful values are 0 <= theta <= 1. Forces follow update_force(): the
+// strength is G m1 m2 / (d^2 + softening) along the unit vector between the two.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#include <parallel/algorithm>
+#endif
+
+class barnes_hut {
+public:
+  explicit barnes_hut(double theta = 0.5, size_t leaf_size = 16)
+    :theta(theta), leaf_size(leaf_size)
+  {}
+
+  // Sets f[xyz][i] to the approximate force on particle i from all the others
+  void compute(size_t n, const double* mass, const double* x, const double* y, const double* z,
+               double* fx, double* fy, double* fz, double G, double softening) {
+    if (n == 0)
+      return;
+    sort_particles(n, mass, x, y, z);
+
+    nodes.clear();
+    #pragma omp parallel
+    #pragma omp single
+    build(0, n, 0, nodes);
+
+    const double theta_sq = theta * theta;
+    const node* tree = nodes.data();
+    const uint32_t nb_nodes = nodes.size();
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < n; ++i) {
+      const double xi = px[i], yi = py[i], zi = pz[i], mi = pm[i];
+      double fxi = 0., fyi = 0., fzi = 0.;
+      for (uint32_t k = 0; k < nb_nodes; ) {
+        const node& c = tree[k];
+        double dx = c.cx - xi, dy = c.cy - yi, dz = c.cz - zi;
+        double dist_sq = dx*dx + dy*dy + dz*dz;
+        if (c.leaf) {
+          for (uint32_t j = c.first; j < c.end; ++j) {
+            if (j == i)
+              continue;
+            dx = px[j] - xi; dy = py[j] - yi; dz = pz[j] - zi;
+            dist_sq = dx*dx + dy*dy + dz*dz;
+            double F = G * pm[j] * mi / ((dist_sq + softening) * std::sqrt(dist_sq));
+            fxi += dx*F; fyi += dy*F; fzi += dz*F;
+          }
+          k += c.skip;
+        } else if ((i < c.first || i >= c.end) && c.size_sq < theta_sq * dist_sq) {
+          double F = G * c.mass * mi / ((dist_sq + softening) * std::sqrt(dist_sq));
+          fxi += dx*F; fyi += dy*F; fzi += dz*F;
+          k += c.skip;
+        } else {
+          k += 1;
+        }
+      }
+      const uint32_t p = order[i];
+      fx[p] = fxi;
+      fy[p] = fyi;
+      fz[p] = fzi;
+    }
+  }
+
+  size_t tree_size() const { return nodes.size(); }
+
+  double theta;
+  size_t leaf_size;
+
+private:
+  static const int BITS = 21;                       // per axis
+  static const size_t PARALLEL_CUTOFF = 1 << 14;    // smaller cells are built by one task
+
+  struct node {
+    double cx, cy, cz, mass;    // center of mass and total mass
+    double size_sq;             // squared side of the cell
+    uint32_t skip;              // nodes in this subtree, itself included
+    uint32_t first, end;        // sorted particles in the cell
+    bool leaf;
+  };
+
+  struct keyed {
+    uint64_t code;
+    uint32_t index;
+    bool operator<(const keyed& o) const { return code != o.code ? code < o.code : index < o.index; }
+  };
+
+  // Spreads the low 21 bits of v so that two zero bits follow each of them
+  static uint64_t spread(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8) & 0x100f00f00f00f00fULL;
+    v = (v | v << 4) & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2) & 0x1249249249249249ULL;
+    return v;
+  }
+
+  // Morton codes in the bounding cube, then the particles copied in code order
+  void sort_particles(size_t n, const double* mass, const double* x, const double* y, const double* z) {
+    double minx = x[0], miny = y[0], minz = z[0], maxx = x[0], maxy = y[0], maxz = z[0];
+    #pragma omp parallel for reduction(min:minx, miny, minz) reduction(max:maxx, maxy, maxz)
+    for (size_t i = 0; i < n; ++i) {
+      minx = std::min(minx, x[i]); maxx = std::max(maxx, x[i]);
+      miny = std::min(miny, y[i]); maxy = std::max(maxy, y[i]);
+      minz = std::min(minz, z[i]); maxz = std::max(maxz, z[i]);
+    }
+    extent = std::max(maxx - minx, std::max(maxy - miny, maxz - minz));
+    if (!(extent > 0.))
+      extent = 1.;
+    extent *= 1. + 1e-9;        // keeps the largest coordinate inside the last cell
+    const double scale = (1 << BITS) / extent;
+
+    keys.resize(n);
+    #pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t qx = std::min<uint64_t>((x[i] - minx) * scale, (1 << BITS) - 1);
+      uint64_t qy = std::min<uint64_t>((y[i] - miny) * scale, (1 << BITS) - 1);
+      uint64_t qz = std::min<uint64_t>((z[i] - minz) * scale, (1 << BITS) - 1);
+      keys[i].code = spread(qx) << 2 | spread(qy) << 1 | spread(qz);
+      keys[i].index = i;
+    }
+#ifdef _OPENMP
+    __gnu_parallel::sort(keys.begin(), keys.end());
+#else
+    std::sort(keys.begin(), keys.end());
+#endif
+
+    px.resize(n); py.resize(n); pz.resize(n); pm.resize(n); order.resize(n);
+    #pragma omp parallel for
+    for (size_t i = 0; i < n; ++i) {
+      const uint32_t p = keys[i].index;
+      order[i] = p;
+      px[i] = x[p]; py[i] = y[p]; pz[i] = z[p]; pm[i] = mass[p];
+    }
+  }
+
+  // Appends the subtree of the cell holding sorted particles [first, end) at the given depth
+  void build(uint32_t first, uint32_t end, int level, std::vector<node>& out) {
+    const double side = extent / (1 << level);
+    node self;
+    self.size_sq = side * side;
+    self.first = first;
+    self.end = end;
+    self.leaf = end - first <= leaf_size || level == BITS;
+
+    if (self.leaf) {
+      double m = 0., cx = 0., cy = 0., cz = 0.;
+      for (uint32_t j = first; j < end; ++j) {
+        m += pm[j];
+        cx += pm[j] * px[j]; cy += pm[j] * py[j]; cz += pm[j] * pz[j];
+      }
+      finish(self, m, cx, cy, cz, first, end);
+      self.skip = 1;
+      out.push_back(self);
+      return;
+    }
+
+    // The children's ranges: the particles are sorted by the next octal digit of their code
+    const int shift = 3 * (BITS - 1 - level);
+    const uint64_t prefix = keys[first].code >> (shift + 3) << (shift + 3);
+    uint32_t bounds[9];
+    bounds[0] = first;
+    for (uint64_t d = 1; d < 8; ++d) {
+      keyed probe = {prefix | d << shift, 0};
+      bounds[d] = std::lower_bound(keys.begin() + bounds[d - 1], keys.begin() + end, probe) - keys.begin();
+    }
+    bounds[8] = end;
+
+    double m = 0., cx = 0., cy = 0., cz = 0.;
+    if (end - first > PARALLEL_CUTOFF) {
+      std::vector<node> children[8];
+      for (int d = 0; d < 8; ++d) {
+        if (bounds[d] == bounds[d + 1])
+          continue;
+        #pragma omp task shared(children)
+        build(bounds[d], bounds[d + 1], level + 1, children[d]);
+      }
+      #pragma omp taskwait
+      size_t total = 1;
+      for (int d = 0; d < 8; ++d) {
+        if (children[d].empty())
+          continue;
+        add_child(children[d][0], m, cx, cy, cz);
+        total += children[d].size();
+      }
+      finish(self, m, cx, cy, cz, first, end);
+      self.skip = total;
+      out.push_back(self);
+      for (int d = 0; d < 8; ++d)
+        out.insert(out.end(), children[d].begin(), children[d].end());
+    } else {
+      const size_t at = out.size();
+      out.push_back(self);
+      for (int d = 0; d < 8; ++d) {
+        if (bounds[d] == bounds[d + 1])
+          continue;
+        const size_t child = out.size();
+        build(bounds[d], bounds[d + 1], level + 1, out);
+        add_child(out[child], m, cx, cy, cz);
+      }
+      finish(out[at], m, cx, cy, cz, first, end);
+      out[at].skip = out.size() - at;
+    }
+  }
+
+  static void add_child(const node& c, double& m, double& cx, double& cy, double& cz) {
+    m += c.mass;
+    cx += c.mass * c.cx; cy += c.mass * c.cy; cz += c.mass * c.cz;
+  }
+
+  // Center of mass from the mass-weighted sums; massless cells sit at their first particle
+  void finish(node& c, double m, double cx, double cy, double cz, uint32_t first, uint32_t end) const {
+    c.mass = m;
+    if (m > 0.) {
+      c.cx = cx / m; c.cy = cy / m; c.cz = cz / m;
+    } else {
+      c.cx = px[first]; c.cy = py[first]; c.cz = pz[first];
+    }
+    c.first = first;
+    c.end = end;
+  }
+
+  double extent = 1.;
+  std::vector<keyed> keys;
+  std::vector<double> px, py, pz, pm;     // particles in Morton order
+  std::vector<uint32_t> order;            // original index of each sorted particle
+  std::vector<node> nodes;
+};
+
+#endif
@@ -24,4 +24,17 @@ echo "Running: 100 particles (dt=1, steps=10000)..."
 echo "Running: 1000 particles (dt=1, steps=10000)..."
 /usr/bin/time -f "Execution time: %e seconds" ./nbody_parallel 1000 1 10000 1000 > results_1000.tsv 2> time_1000.txt
 
+for force in atomic all-pairs symmetric barnes-hut simd; do
+    echo "Running: 10000 particles (dt=1, steps=10) with --force $force..."
+    /usr/bin/time -f "Execution time: %e seconds" ./nbody_parallel 10000 1 10 10 --force $force > /dev/null 2> time_10000_$force.txt
+done
+
+for integrator in euler leapfrog yoshida4; do
+    echo "Running: Solar System over 10 years (dt=20000) with --integrator $integrator..."
+    /usr/bin/time -f "Execution time: %e seconds" ./nbody_parallel planet 20000 15778 1000 --integrator $integrator --energy > /dev/null 2> energy_solar_$integrator.txt
+done
+
+echo "Running: SIMD force kernel throughput and accuracy (20000 particles)..."
+make force_bench && ./force_bench 20000 > force_bench.tsv
+
 echo "All benchmark tasks completed!"
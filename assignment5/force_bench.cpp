@@ -0,0 +1,135 @@
+// Throughput and accuracy of the SIMD force kernels (simd_gravity.h): for each precision mode,
+// tiled and untiled, pair interactions per second and the force error against a scalar double
+// reference. The reference only runs for a sample of targets, so large n stay affordable.
+
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include <omp.h>
+#include "simd_gravity.h"
+
+const double G = 6.674e-11;
+const double softening = .1;
+
+struct particles {
+  std::vector<double> mass, x, y, z;
+  explicit particles(size_t n) :mass(n), x(n), y(n), z(n) {}
+};
+
+struct forces {
+  std::vector<double> fx, fy, fz;
+  explicit forces(size_t n) :fx(n), fy(n), fz(n) {}
+};
+
+// The force law of update_force(), one pair at a time with sqrt and divides, on the sampled
+// targets; f[k] is the force on sample[k]
+void reference_forces(const particles& p, const std::vector<size_t>& sample, forces& f) {
+  const size_t n = p.mass.size();
+  #pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < sample.size(); ++k) {
+    const size_t i = sample[k];
+    double fx = 0., fy = 0., fz = 0.;
+    for (size_t j = 0; j < n; ++j) {
+      if (j == i)
+        continue;
+      double dx = p.x[j] - p.x[i], dy = p.y[j] - p.y[i], dz = p.z[j] - p.z[i];
+      double dist_sq = dx*dx + dy*dy + dz*dz;
+      double F = G * p.mass[j] * p.mass[i] / (dist_sq + softening);
+      double norm = std::sqrt(dist_sq);
+      fx += dx / norm * F; fy += dy / norm * F; fz += dz / norm * F;
+    }
+    f.fx[k] = fx; f.fy[k] = fy; f.fz[k] = fz;
+  }
+}
+
+template <typename Real, typename Acc>
+void run(std::string name, size_t target_block, const particles& p,
+         const std::vector<size_t>& sample, const forces& ref, int repeat) {
+  const size_t n = p.mass.size();
+  gravity_kernel<Real, Acc> kernel;
+  kernel.target_block = target_block;
+  forces f(n);
+
+  kernel.load(n, p.mass.data(), p.x.data(), p.y.data(), p.z.data(), G, softening);
+  kernel.forces(p.mass.data(), f.fx.data(), f.fy.data(), f.fz.data());   // warm up
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeat; ++r) {
+    kernel.load(n, p.mass.data(), p.x.data(), p.y.data(), p.z.data(), G, softening);
+    kernel.forces(p.mass.data(), f.fx.data(), f.fy.data(), f.fz.data());
+  }
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeat;
+
+  // relative error of each sampled force vector
+  double sum_err = 0., max_err = 0.;
+  for (size_t k = 0; k < sample.size(); ++k) {
+    const size_t i = sample[k];
+    double ex = f.fx[i] - ref.fx[k], ey = f.fy[i] - ref.fy[k], ez = f.fz[i] - ref.fz[k];
+    double norm = std::sqrt(ref.fx[k]*ref.fx[k] + ref.fy[k]*ref.fy[k] + ref.fz[k]*ref.fz[k]);
+    double err = std::sqrt(ex*ex + ey*ey + ez*ez) / norm;
+    sum_err += err;
+    max_err = std::max(max_err, err);
+  }
+
+  if (target_block == 1)
+    name += "/untiled";
+  std::cout<<name<<'\t'<<kernel.source_tile<<'\t'<<seconds<<'\t'<<n * (n - 1) / seconds / 1e9<<'\t'
+           <<sum_err / sample.size()<<'\t'<<max_err<<'\n';
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr<<"usage: "<<argv[0]<<" <nbpart> [repeat]"<<"\n";
+    return -1;
+  }
+  const size_t n = std::atol(argv[1]);
+  const int repeat = argc > 2 ? std::max(1, std::atoi(argv[2])) : 3;
+  if (n < 2) {
+    std::cerr<<"need at least 2 particles"<<"\n";
+    return -1;
+  }
+
+  // a 3D Gaussian cloud, with a fixed seed so runs compare
+  std::mt19937 gen(1);
+  std::uniform_real_distribution<double> dismass(0.9, 1.);
+  std::normal_distribution<double> dispos(0., 1.);
+  particles p(n);
+  for (size_t i = 0; i < n; ++i) {
+    p.mass[i] = dismass(gen);
+    p.x[i] = dispos(gen); p.y[i] = dispos(gen); p.z[i] = dispos(gen);
+  }
+
+  // about 2000 targets spread over the cloud
+  std::vector<size_t> sample;
+  for (size_t i = 0; i < n; i += std::max<size_t>(n / 2000, 1))
+    sample.push_back(i);
+  forces ref(sample.size());
+  const auto start = std::chrono::steady_clock::now();
+  reference_forces(p, sample, ref);
+  const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+    * n / sample.size();
+
+#if defined(__AVX512F__)
+  const char* isa = "avx512";
+#elif defined(__AVX2__) && defined(__FMA__)
+  const char* isa = "avx2";
+#else
+  const char* isa = "scalar";
+#endif
+  std::cout<<"# "<<n<<" particles, "<<omp_get_max_threads()<<" threads, "<<isa
+           <<", L1 data cache "<<gravity_kernel<float, float>::l1_data_cache()<<" bytes"<<"\n"
+           <<"mode\ttile\tseconds\tGinteractions/s\tmean_rel_error\tmax_rel_error"<<"\n"
+           <<"reference\t-\t"<<seconds<<'\t'<<n * (n - 1) / seconds / 1e9<<"\t0\t0"<<"\n";
+  // the default target block, then one target at a time streaming every source
+  const size_t blocks[] = {gravity_kernel<float, float>().target_block, 1};
+  for (size_t block : blocks) {
+    run<double, double>("double", block, p, sample, ref, repeat);
+    run<float, double>("mixed", block, p, sample, ref, repeat);
+    run<float, float>("float", block, p, sample, ref, repeat);
+  }
+  return 0;
+}
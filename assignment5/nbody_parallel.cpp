@@ -3,9 +3,14 @@
 #include <random>
 #include <cmath>
 #include <omp.h> //  OpenMP for parallelization
+#include <string>
+#include <algorithm>
+#include "barnes_hut.h"
+#include "simd_gravity.h"
 
 double G = 6.674*std::pow(10,-11);
 //double G = 1;
+double softening = .1;
 
 struct simulation {
   size_t nbpart;
@@ -110,7 +115,6 @@ void init_solar(simulation& s) {
 
 //meant to update the force that from applies on to
 void update_force(simulation& s, size_t from, size_t to) {
-  double softening = .1;
   double dist_sq = std::pow(s.x[from]-s.x[to],2)
     + std::pow(s.y[from]-s.y[to],2)
     + std::pow(s.z[from]-s.z[to],2);
@@ -144,6 +148,173 @@ void reset_force(simulation& s) {
   }
 }
 
+// ATOMIC: the original loop over all (i, j), three atomic adds per pair
+// ALL_PAIRS: parallel over targets, each force summed in registers and written once
+// SYMMETRIC: every pair evaluated once for both particles (Newton's third law)
+// BARNES_HUT: octree approximation, see barnes_hut.h
+// SIMD: ALL_PAIRS with explicit vector intrinsics, in the chosen precision, see simd_gravity.h
+enum force_backend {ATOMIC, ALL_PAIRS, SYMMETRIC, BARNES_HUT, SIMD};
+
+// DOUBLE_PRECISION: double throughout
+// MIXED_PRECISION: pair terms in float, sums in double
+// SINGLE_PRECISION: float throughout
+enum precision_mode {DOUBLE_PRECISION, MIXED_PRECISION, SINGLE_PRECISION};
+
+struct force_solver {
+  force_backend backend = ALL_PAIRS;
+  precision_mode precision = DOUBLE_PRECISION;
+  barnes_hut tree;
+  std::vector<double> partial;   // per-thread force buffers of SYMMETRIC, 3 * nbpart each
+  gravity_kernel<double, double> kernel_double;
+  gravity_kernel<float, double> kernel_mixed;
+  gravity_kernel<float, float> kernel_single;
+};
+
+// Adds to (fx, fy, fz) the force particles [begin, end) apply on (xi, yi, zi, mi). The loop has
+// no branch, so the compiler can vectorize it; the caller leaves i itself out of the range.
+inline void accumulate_force(const simulation& s, size_t begin, size_t end,
+                             double xi, double yi, double zi, double mi,
+                             double& fx, double& fy, double& fz) {
+  const double* x = s.x.data();
+  const double* y = s.y.data();
+  const double* z = s.z.data();
+  const double* m = s.mass.data();
+  double ax = 0., ay = 0., az = 0.;
+  #pragma omp simd reduction(+:ax, ay, az)
+  for (size_t j=begin; j<end; ++j) {
+    double dx = x[j]-xi;
+    double dy = y[j]-yi;
+    double dz = z[j]-zi;
+    double dist_sq = dx*dx+dy*dy+dz*dz;
+    double F = G * m[j]*mi / ((dist_sq+softening) * std::sqrt(dist_sq));
+    ax += dx*F;
+    ay += dy*F;
+    az += dz*F;
+  }
+  fx += ax;
+  fy += ay;
+  fz += az;
+}
+
+void all_pairs_forces(simulation& s) {
+  #pragma omp parallel for schedule(static)
+  for (size_t i=0; i<s.nbpart; ++i) {
+    double fx = 0., fy = 0., fz = 0.;
+    accumulate_force(s, 0, i, s.x[i], s.y[i], s.z[i], s.mass[i], fx, fy, fz);
+    accumulate_force(s, i+1, s.nbpart, s.x[i], s.y[i], s.z[i], s.mass[i], fx, fy, fz);
+    s.fx[i] = fx;
+    s.fy[i] = fy;
+    s.fz[i] = fz;
+  }
+}
+
+// Each pair (i, j > i) is evaluated once, its force added to i and subtracted from j in the
+// thread's own buffer; the buffers are then summed per particle. Half the pair evaluations of
+// ALL_PAIRS, for nbthreads * nbpart * 3 doubles of scratch space. The scratch space is sized on
+// the first step only, and each thread zeroes its own buffer in parallel on every step.
+void symmetric_forces(simulation& s, std::vector<double>& partial) {
+  const size_t n = s.nbpart;
+  const int nbthreads = omp_get_max_threads();
+  if (partial.size() != 3 * n * nbthreads)
+    partial.resize(3 * n * nbthreads);
+
+  #pragma omp parallel num_threads(nbthreads)
+  {
+    // the team may be smaller than asked for; only its buffers are zeroed and summed
+    const int team = omp_get_num_threads();
+    double* fx = partial.data() + 3 * n * omp_get_thread_num();
+    double* fy = fx + n;
+    double* fz = fy + n;
+    std::fill(fx, fx + 3 * n, 0.);
+    const double* x = s.x.data();
+    const double* y = s.y.data();
+    const double* z = s.z.data();
+    const double* m = s.mass.data();
+
+    // rows get shorter with i, hence the dynamic schedule
+    #pragma omp for schedule(dynamic, 16)
+    for (size_t i=0; i<n; ++i) {
+      const double xi = x[i], yi = y[i], zi = z[i], mi = m[i];
+      double ax = 0., ay = 0., az = 0.;
+      #pragma omp simd reduction(+:ax, ay, az)
+      for (size_t j=i+1; j<n; ++j) {
+        double dx = x[j]-xi;
+        double dy = y[j]-yi;
+        double dz = z[j]-zi;
+        double dist_sq = dx*dx+dy*dy+dz*dz;
+        double F = G * m[j]*mi / ((dist_sq+softening) * std::sqrt(dist_sq));
+        ax += dx*F;
+        ay += dy*F;
+        az += dz*F;
+        fx[j] -= dx*F;
+        fy[j] -= dy*F;
+        fz[j] -= dz*F;
+      }
+      fx[i] += ax;
+      fy[i] += ay;
+      fz[i] += az;
+    }
+
+    #pragma omp for schedule(static)
+    for (size_t i=0; i<n; ++i) {
+      double sx = 0., sy = 0., sz = 0.;
+      for (int t=0; t<team; ++t) {
+        const double* f = partial.data() + 3 * n * t;
+        sx += f[i];
+        sy += f[n + i];
+        sz += f[2 * n + i];
+      }
+      s.fx[i] = sx;
+      s.fy[i] = sy;
+      s.fz[i] = sz;
+    }
+  }
+}
+
+template <typename Real, typename Acc>
+void simd_forces(simulation& s, gravity_kernel<Real, Acc>& kernel) {
+  kernel.load(s.nbpart, s.mass.data(), s.x.data(), s.y.data(), s.z.data(), G, softening);
+  kernel.forces(s.mass.data(), s.fx.data(), s.fy.data(), s.fz.data());
+}
+
+// Forces on every particle with the solver's backend
+void compute_forces(simulation& s, force_solver& solver) {
+  switch (solver.backend) {
+  case ATOMIC:
+    reset_force(s);
+    // parallel nested loop to update all pairwise forces
+    #pragma omp parallel for collapse(2)  // because 2 nested loop
+    for (size_t i=0; i<s.nbpart; ++i)
+      for (size_t j=0; j<s.nbpart; ++j)
+        if (i != j)
+          update_force(s, i, j);
+    break;
+  case ALL_PAIRS:
+    all_pairs_forces(s);
+    break;
+  case SYMMETRIC:
+    symmetric_forces(s, solver.partial);
+    break;
+  case BARNES_HUT:
+    solver.tree.compute(s.nbpart, s.mass.data(), s.x.data(), s.y.data(), s.z.data(),
+                        s.fx.data(), s.fy.data(), s.fz.data(), G, softening);
+    break;
+  case SIMD:
+    switch (solver.precision) {
+    case DOUBLE_PRECISION:
+      simd_forces(s, solver.kernel_double);
+      break;
+    case MIXED_PRECISION:
+      simd_forces(s, solver.kernel_mixed);
+      break;
+    case SINGLE_PRECISION:
+      simd_forces(s, solver.kernel_single);
+      break;
+    }
+    break;
+  }
+}
+
 void apply_force(simulation& s, size_t i, double dt) {
   s.vx[i] += s.fx[i]/s.mass[i]*dt;
   s.vy[i] += s.fy[i]/s.mass[i]*dt;
@@ -156,6 +327,117 @@ void update_position(simulation& s, size_t i, double dt) {
   s.z[i] += s.vz[i]*dt;
 }
 
+// EULER: the original step, velocities from the current forces then positions (symplectic
+//   Euler, first order, one force pass)
+// LEAPFROG: kick-drift-kick, second order, one force pass (the last one is reused)
+// VERLET: velocity Verlet, x += v dt + a dt^2/2 then v += (a + a') dt/2; the same trajectory
+//   as LEAPFROG up to rounding, kept in the textbook form
+// YOSHIDA4: three leapfrog steps of w1 dt, w0 dt, w1 dt, fourth order, three force passes
+enum integration_scheme {EULER, LEAPFROG, VERLET, YOSHIDA4};
+
+struct integrator {
+  integration_scheme scheme = EULER;
+  bool forces_current = false;      // s.f[xyz] are the forces at the current positions
+  std::vector<double> previous;     // VERLET: forces at the start of the step, 3 * nbpart
+};
+
+void kick(simulation& s, double dt) {
+  #pragma omp parallel for
+  for (size_t i=0; i<s.nbpart; ++i)
+    apply_force(s, i, dt);
+}
+
+void drift(simulation& s, double dt) {
+  #pragma omp parallel for
+  for (size_t i=0; i<s.nbpart; ++i)
+    update_position(s, i, dt);
+}
+
+void leapfrog_step(simulation& s, force_solver& solver, integrator& integ, double dt) {
+  if (!integ.forces_current)
+    compute_forces(s, solver);
+  kick(s, dt/2);
+  drift(s, dt);
+  compute_forces(s, solver);
+  kick(s, dt/2);
+  integ.forces_current = true;
+}
+
+void verlet_step(simulation& s, force_solver& solver, integrator& integ, double dt) {
+  const size_t n = s.nbpart;
+  if (!integ.forces_current)
+    compute_forces(s, solver);
+  integ.previous.resize(3 * n);
+  #pragma omp parallel for
+  for (size_t i=0; i<n; ++i) {
+    integ.previous[i] = s.fx[i];
+    integ.previous[n + i] = s.fy[i];
+    integ.previous[2 * n + i] = s.fz[i];
+    s.x[i] += (s.vx[i] + s.fx[i]/s.mass[i]*dt/2)*dt;
+    s.y[i] += (s.vy[i] + s.fy[i]/s.mass[i]*dt/2)*dt;
+    s.z[i] += (s.vz[i] + s.fz[i]/s.mass[i]*dt/2)*dt;
+  }
+  compute_forces(s, solver);
+  #pragma omp parallel for
+  for (size_t i=0; i<n; ++i) {
+    s.vx[i] += (integ.previous[i] + s.fx[i])/s.mass[i]*dt/2;
+    s.vy[i] += (integ.previous[n + i] + s.fy[i])/s.mass[i]*dt/2;
+    s.vz[i] += (integ.previous[2 * n + i] + s.fz[i])/s.mass[i]*dt/2;
+  }
+  integ.forces_current = true;
+}
+
+// Advances the simulation by dt with the integrator's scheme
+void integrate(simulation& s, force_solver& solver, integrator& integ, double dt) {
+  switch (integ.scheme) {
+  case EULER:
+    compute_forces(s, solver);
+    #pragma omp parallel for
+    for (size_t i=0; i<s.nbpart; ++i) {
+      apply_force(s, i, dt);
+      update_position(s, i, dt);
+    }
+    integ.forces_current = false;
+    break;
+  case LEAPFROG:
+    leapfrog_step(s, solver, integ, dt);
+    break;
+  case VERLET:
+    verlet_step(s, solver, integ, dt);
+    break;
+  case YOSHIDA4: {
+    // Yoshida (1990): w1 = 1/(2 - 2^(1/3)), w0 = 1 - 2 w1 (negative: the middle step goes back)
+    const double w1 = 1./(2. - std::cbrt(2.));
+    const double w0 = 1. - 2.*w1;
+    leapfrog_step(s, solver, integ, w1*dt);
+    leapfrog_step(s, solver, integ, w0*dt);
+    leapfrog_step(s, solver, integ, w1*dt);
+    break;
+  }
+  }
+}
+
+// Kinetic plus potential energy. The potential is the one the force law derives from:
+// F(r) = G m1 m2 / (r^2 + softening) gives U(r) = -G m1 m2 atan(sqrt(softening) / r) / sqrt(softening),
+// which tends to -G m1 m2 / r when softening goes to 0. O(n^2), like the all-pairs force pass.
+double total_energy(const simulation& s) {
+  const size_t n = s.nbpart;
+  const double eps = std::sqrt(softening);
+  double energy = 0.;
+  #pragma omp parallel for schedule(dynamic, 16) reduction(+:energy)
+  for (size_t i=0; i<n; ++i) {
+    energy += s.mass[i] * (s.vx[i]*s.vx[i] + s.vy[i]*s.vy[i] + s.vz[i]*s.vz[i]) / 2;
+    for (size_t j=i+1; j<n; ++j) {
+      double dx = s.x[j]-s.x[i];
+      double dy = s.y[j]-s.y[i];
+      double dz = s.z[j]-s.z[i];
+      double r = std::sqrt(dx*dx+dy*dy+dz*dz);
+      energy -= G * s.mass[i]*s.mass[j] * (eps > 0. ? std::atan(eps/r)/eps : 1./r);
+    }
+  }
+  return energy;
+}
+
 void dump_state(simulation& s) {
   std::cout<<s.nbpart<<'\t';
   for (size_t i=0; i<s.nbpart; ++i) {
@@ -183,9 +465,10 @@ void load_from_file(simulation& s, std::string filename) {
 }
 
 int main(int argc, char* argv[]) {
-  if (argc != 5) {
+  if (argc < 5) {
     std::cerr
-      <<"usage: "<<argv[0]<<" <input> <dt> <nbstep> <printevery>"<<"\n"
+      <<"usage: "<<argv[0]<<" <input> <dt> <nbstep> <printevery> [--force all-pairs|symmetric|atomic|barnes-hut|simd] [--theta T] [--precision double|mixed|float]"<<"\n"
+      <<"       [--integrator euler|leapfrog|verlet|yoshida4] [--energy]"<<"\n"
       <<"input can be:"<<"\n"
       <<"a number (random initialization)"<<"\n"
       <<"planet (initialize with solar system)"<<"\n"
@@ -196,6 +479,67 @@ int main(int argc, char* argv[]) {
   double dt = std::atof(argv[2]); //in seconds
   size_t nbstep = std::atol(argv[3]);
   size_t printevery = std::atol(argv[4]);
+
+  force_solver solver;
+  integrator integ;
+  bool track_energy = false;
+  for (int i = 5; i < argc; ++i) {
+    std::string option = argv[i];
+    if (option == "--force" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "all-pairs") {
+        solver.backend = ALL_PAIRS;
+      } else if (name == "symmetric") {
+        solver.backend = SYMMETRIC;
+      } else if (name == "atomic") {
+        solver.backend = ATOMIC;
+      } else if (name == "barnes-hut") {
+        solver.backend = BARNES_HUT;
+      } else if (name == "simd") {
+        solver.backend = SIMD;
+      } else {
+        std::cerr<<"unknown force backend: "<<name<<"\n";
+        return -1;
+      }
+    } else if (option == "--theta" && i + 1 < argc) {
+      solver.tree.theta = std::atof(argv[++i]);
+      if (!(solver.tree.theta >= 0. && solver.tree.theta <= 1.)) {
+        std::cerr<<"theta must be between 0 and 1"<<"\n";
+        return -1;
+      }
+    } else if (option == "--precision" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "double") {
+        solver.precision = DOUBLE_PRECISION;
+      } else if (name == "mixed") {
+        solver.precision = MIXED_PRECISION;
+      } else if (name == "float") {
+        solver.precision = SINGLE_PRECISION;
+      } else {
+        std::cerr<<"unknown precision: "<<name<<"\n";
+        return -1;
+      }
+    } else if (option == "--integrator" && i + 1 < argc) {
+      std::string name = argv[++i];
+      if (name == "euler") {
+        integ.scheme = EULER;
+      } else if (name == "leapfrog") {
+        integ.scheme = LEAPFROG;
+      } else if (name == "verlet") {
+        integ.scheme = VERLET;
+      } else if (name == "yoshida4") {
+        integ.scheme = YOSHIDA4;
+      } else {
+        std::cerr<<"unknown integrator: "<<name<<"\n";
+        return -1;
+      }
+    } else if (option == "--energy") {
+      track_energy = true;
+    } else {
+      std::cerr<<"unknown option: "<<option<<"\n";
+      return -1;
+    }
+  }
   
   
   simulation s(1);
@@ -217,24 +561,29 @@ int main(int argc, char* argv[]) {
   }
 
   
+  // --energy: step, time, energy and drift relative to the start on stderr at every print
+  const double initial_energy = track_energy ? total_energy(s) : 0.;
+  double max_drift = 0.;
+  auto report_energy = [&](size_t step) {
+    const double energy = total_energy(s);
+    const double drift = (energy - initial_energy) / std::abs(initial_energy);
+    max_drift = std::max(max_drift, std::abs(drift));
+    std::cerr<<step<<'\t'<<step*dt<<'\t'<<energy<<'\t'<<drift<<'\n';
+  };
+
   for (size_t step = 0; step< nbstep; step++) {
-    if (step %printevery == 0)
+    if (step %printevery == 0) {
       dump_state(s);
-  
-    reset_force(s);
-    
-    // parallel nested loop to update all pairwise forces    
-    #pragma omp parallel for collapse(2)  // because 2 nested loop
-    for (size_t i=0; i<s.nbpart; ++i)
-      for (size_t j=0; j<s.nbpart; ++j)
-	if (i != j)
-	  update_force(s, i, j);
-
-    #pragma omp parallel for
-    for (size_t i=0; i<s.nbpart; ++i) {
-      apply_force(s, i, dt);
-      update_position(s, i, dt);
+      if (track_energy)
+        report_energy(step);
     }
+
+    integrate(s, solver, integ, dt);
+  }
+
+  if (track_energy) {
+    report_energy(nbstep);
+    std::cerr<<"max relative energy drift: "<<max_drift<<'\n';
   }
 
    //dump_state(s);  
@@ -0,0 +1,288 @@
+#ifndef SIMD_GRAVITY_H
+#define SIMD_GRAVITY_H
+
+// Explicitly vectorized all-pairs gravity. The same force law as update_force(), reorganized
+// for SIMD: per pair one rsqrt and one reciprocal, each an approximate instruction refined by
+// Newton steps, and FMAs for everything else; no pow, no sqrt, no divide. The j loop runs over
+// SoA copies of x/y/z/G*mass, two registers at a time so two independent chains of FMAs are in
+// flight.
+//
+// The loops are tiled like the shared-memory version of a CUDA kernel: the sources are cut
+// into tiles sized to half the L1 data cache, and a block of target_block targets runs through
+// one tile before the next is touched. Each source is then read from L2 or memory once per
+// target block rather than once per target, so the kernel stays compute-bound when the
+// particles no longer fit in L2 (beyond ~1e5 in float).
+//
+// gravity_kernel<Real, Acc> is instantiated per precision mode:
+//   <double, double>  double everywhere
+//   <float, float>    pair math and sums in float: twice the lanes, about 7 significant digits
+//   <float, double>   pair math in float, each target's sums carried over to double after
+//                     every tile, so rounding does not grow with the number of particles
+// The instruction set is picked at compile time: AVX-512 if __AVX512F__, else AVX2 with FMA,
+// else a scalar version of the same code.
+//
+// Forces come out as G m_i sum_j m_j d_ij / ((|d_ij|^2 + softening) |d_ij|). Particles at the
+// exact same position exert no force on each other (the reference would produce a NaN), which
+// is also how a particle's own term drops out without a branch.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include <unistd.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// One SIMD register of T and the handful of operations the kernel needs
+template <typename T> struct simd;
+
+#if defined(__AVX512F__)
+
+template <> struct simd<float> {
+  typedef __m512 reg;
+  static const int width = 16;
+  static const int newton_steps = 1;       // rsqrt14/rcp14 give 14 bits, one step gives ~24
+  static reg load(const float* p) { return _mm512_loadu_ps(p); }
+  static reg set1(float v) { return _mm512_set1_ps(v); }
+  static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_ps(a, b, c); }
+  static reg max(reg a, reg b) { return _mm512_max_ps(a, b); }
+  static reg rsqrt_estimate(reg a) { return _mm512_rsqrt14_ps(a); }
+  static reg rcp_estimate(reg a) { return _mm512_rcp14_ps(a); }
+  static float sum(reg a) { return _mm512_reduce_add_ps(a); }
+};
+
+template <> struct simd<double> {
+  typedef __m512d reg;
+  static const int width = 8;
+  static const int newton_steps = 2;       // 14 -> 28 -> 53 bits
+  static reg load(const double* p) { return _mm512_loadu_pd(p); }
+  static reg set1(double v) { return _mm512_set1_pd(v); }
+  static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm512_fnmadd_pd(a, b, c); }
+  static reg max(reg a, reg b) { return _mm512_max_pd(a, b); }
+  static reg rsqrt_estimate(reg a) { return _mm512_rsqrt14_pd(a); }
+  static reg rcp_estimate(reg a) { return _mm512_rcp14_pd(a); }
+  static double sum(reg a) { return _mm512_reduce_add_pd(a); }
+};
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+template <> struct simd<float> {
+  typedef __m256 reg;
+  static const int width = 8;
+  static const int newton_steps = 1;       // rsqrt/rcp give 12 bits, one step gives ~23
+  static reg load(const float* p) { return _mm256_loadu_ps(p); }
+  static reg set1(float v) { return _mm256_set1_ps(v); }
+  static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_ps(a, b, c); }
+  static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+  static reg rsqrt_estimate(reg a) { return _mm256_rsqrt_ps(a); }
+  static reg rcp_estimate(reg a) { return _mm256_rcp_ps(a); }
+  static float sum(reg a) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+  }
+};
+
+// AVX2 has no double estimates: take the float ones (valid while values fit in a float)
+template <> struct simd<double> {
+  typedef __m256d reg;
+  static const int width = 4;
+  static const int newton_steps = 3;       // 12 -> 24 -> 48 -> 53 bits
+  static reg load(const double* p) { return _mm256_loadu_pd(p); }
+  static reg set1(double v) { return _mm256_set1_pd(v); }
+  static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+  static reg fnmadd(reg a, reg b, reg c) { return _mm256_fnmadd_pd(a, b, c); }
+  static reg max(reg a, reg b) { return _mm256_max_pd(a, b); }
+  static reg rsqrt_estimate(reg a) { return _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(a))); }
+  static reg rcp_estimate(reg a) { return _mm256_cvtps_pd(_mm_rcp_ps(_mm256_cvtpd_ps(a))); }
+  static double sum(reg a) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+  }
+};
+
+#else
+
+// Scalar fallback: exact estimates, so no Newton steps
+template <typename T> struct simd {
+  typedef T reg;
+  static const int width = 1;
+  static const int newton_steps = 0;
+  static reg load(const T* p) { return *p; }
+  static reg set1(T v) { return v; }
+  static reg add(reg a, reg b) { return a + b; }
+  static reg sub(reg a, reg b) { return a - b; }
+  static reg mul(reg a, reg b) { return a * b; }
+  static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+  static reg fnmadd(reg a, reg b, reg c) { return c - a * b; }
+  static reg max(reg a, reg b) { return std::max(a, b); }
+  static reg rsqrt_estimate(reg a) { return 1 / std::sqrt(a); }
+  static reg rcp_estimate(reg a) { return 1 / a; }
+  static T sum(reg a) { return a; }
+};
+
+#endif
+
+template <typename Real, typename Acc>
+class gravity_kernel {
+public:
+  typedef simd<Real> V;
+  typedef typename V::reg reg;
+
+  static const int UNROLL = 2;
+  static const size_t MAX_TARGET_BLOCK = 256;
+
+  explicit gravity_kernel(size_t l1_bytes = l1_data_cache())
+    :source_tile(tile_for(l1_bytes)), target_block(64)
+  {}
+
+  // Sources whose four arrays fill half of l1_bytes, leaving the other half to the rest
+  static size_t tile_for(size_t l1_bytes) {
+    const size_t step = V::width * UNROLL;
+    return std::max<size_t>(l1_bytes / 2 / (4 * sizeof(Real)) / step, 1) * step;
+  }
+
+  // Size of the host's L1 data cache, 32KB if the system does not say
+  static size_t l1_data_cache() {
+    long bytes = 0;
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    bytes = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+    return bytes > 0 ? bytes : 32 * 1024;
+  }
+
+  // Copies positions and G * mass in Real, padded with massless particles to whole registers.
+  // Masses only enter scaled by G, and the target's mass is applied in double at the end, so
+  // float modes hold for masses whose products would overflow a float (planet: m m ~ 1e57).
+  void load(size_t n, const double* mass, const double* x, const double* y, const double* z,
+            double G, double softening) {
+    nbpart = n;
+    soft = softening;
+    const size_t step = V::width * UNROLL;
+    const size_t padded = (n + step - 1) / step * step;
+    px.assign(padded, Real(0)); py.assign(padded, Real(0)); pz.assign(padded, Real(0)); gm.assign(padded, Real(0));
+    for (size_t i = 0; i < n; ++i) {
+      px[i] = x[i]; py[i] = y[i]; pz[i] = z[i];
+      gm[i] = G * mass[i];
+    }
+    // Floor of d^2, so a particle's pair with itself (d = 0) stays finite and vanishes. Taken
+    // in float for every mode, the AVX2 double estimates going through float.
+    tiny = std::sqrt(std::numeric_limits<float>::min());
+  }
+
+  // Forces on all particles, in parallel over blocks of targets
+  void forces(const double* mass, double* fx, double* fy, double* fz) const {
+    const size_t block = std::min(std::max<size_t>(target_block, 1), MAX_TARGET_BLOCK);
+    const size_t nbblocks = (nbpart + block - 1) / block;
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < nbblocks; ++b)
+      force_block(b * block, std::min(nbpart, (b + 1) * block), mass, fx, fy, fz);
+  }
+
+  // Pairs the loop evaluates per target, padding included
+  size_t pairs_per_target() const { return px.size(); }
+
+  size_t source_tile;     // sources per tile, a whole number of unrolled registers
+  size_t target_block;    // targets sharing each tile; 1 streams all sources per target
+
+private:
+  // Forces on targets [first, last), one source tile at a time
+  void force_block(size_t first, size_t last, const double* mass, double* fx, double* fy, double* fz) const {
+    Acc ax[MAX_TARGET_BLOCK], ay[MAX_TARGET_BLOCK], az[MAX_TARGET_BLOCK];
+    std::fill(ax, ax + (last - first), Acc(0));
+    std::fill(ay, ay + (last - first), Acc(0));
+    std::fill(az, az + (last - first), Acc(0));
+    const size_t padded = px.size();
+    for (size_t tile = 0; tile < padded; tile += source_tile) {
+      const size_t end = std::min(padded, tile + source_tile);
+      for (size_t i = first; i < last; ++i) {
+        Real sx, sy, sz;
+        tile_sum(i, tile, end, sx, sy, sz);
+        ax[i - first] += sx;
+        ay[i - first] += sy;
+        az[i - first] += sz;
+      }
+    }
+    for (size_t i = first; i < last; ++i) {
+      fx[i] = mass[i] * ax[i - first];
+      fy[i] = mass[i] * ay[i - first];
+      fz[i] = mass[i] * az[i - first];
+    }
+  }
+
+  // Acceleration of target i from sources [begin, end), summed in Real
+  void tile_sum(size_t i, size_t begin, size_t end, Real& ax, Real& ay, Real& az) const {
+    const reg xi = V::set1(px[i]), yi = V::set1(py[i]), zi = V::set1(pz[i]);
+    const reg softening = V::set1(soft), floor = V::set1(tiny);
+    reg sx[UNROLL], sy[UNROLL], sz[UNROLL];
+    for (int u = 0; u < UNROLL; ++u)
+      sx[u] = sy[u] = sz[u] = V::set1(0);
+    for (size_t j = begin; j < end; j += V::width * UNROLL) {
+      for (int u = 0; u < UNROLL; ++u) {
+        const size_t k = j + u * V::width;
+        reg dx = V::sub(V::load(&px[k]), xi);
+        reg dy = V::sub(V::load(&py[k]), yi);
+        reg dz = V::sub(V::load(&pz[k]), zi);
+        reg dist_sq = V::max(V::fmadd(dx, dx, V::fmadd(dy, dy, V::mul(dz, dz))), floor);
+        reg w = V::mul(V::mul(V::load(&gm[k]), rsqrt(dist_sq)), rcp(V::add(dist_sq, softening)));
+        sx[u] = V::fmadd(dx, w, sx[u]);
+        sy[u] = V::fmadd(dy, w, sy[u]);
+        sz[u] = V::fmadd(dz, w, sz[u]);
+      }
+    }
+    for (int u = 1; u < UNROLL; ++u) {
+      sx[0] = V::add(sx[0], sx[u]);
+      sy[0] = V::add(sy[0], sy[u]);
+      sz[0] = V::add(sz[0], sz[u]);
+    }
+    ax = V::sum(sx[0]);
+    ay = V::sum(sy[0]);
+    az = V::sum(sz[0]);
+  }
+
+  // y <- y (3 - a y^2) / 2
+  static reg rsqrt(reg a) {
+    reg y = V::rsqrt_estimate(a);
+    const reg half_a = V::mul(a, V::set1(Real(.5))), three_halves = V::set1(Real(1.5));
+    for (int s = 0; s < V::newton_steps; ++s)
+      y = V::mul(y, V::fnmadd(half_a, V::mul(y, y), three_halves));
+    return y;
+  }
+
+  // y <- y (2 - a y)
+  static reg rcp(reg a) {
+    reg y = V::rcp_estimate(a);
+    const reg two = V::set1(Real(2));
+    for (int s = 0; s < V::newton_steps; ++s)
+      y = V::mul(y, V::fnmadd(a, y, two));
+    return y;
+  }
+
+  size_t nbpart = 0;
+  Real soft = 0, tiny = 0;
+  std::vector<Real> px, py, pz, gm;
+};
+
+template <typename Real, typename Acc>
+const size_t gravity_kernel<Real, Acc>::MAX_TARGET_BLOCK;
+
+#endif